@@ -10,12 +10,55 @@
 #include <functional>
 #include <fstream>
 #include <filesystem>
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <mutex>
+#include <utility>
+#include <bit>
+#include <charconv>
+#include <unordered_map>
 namespace fs = std::filesystem;
 
+// what sv::find_first_of scans with, sse2 is always there on x86-64
+#if defined __AVX2__
+#define STDCPP_AVX2
+#include <immintrin.h>
+#elif defined __SSE2__ || defined _M_X64 || (defined _M_IX86_FP && _M_IX86_FP >= 2)
+#define STDCPP_SSE2
+#include <emmintrin.h>
+#endif
+
 #if defined USE_WINAPI
 #define WIN32_MEAN_AND_LEAN
+// before windows.h, which drags in the old winsock.h otherwise
+#include <winsock2.h>
+#include <ws2tcpip.h>
 #include <windows.h>
 #include <shellapi.h>
+#include <psapi.h>
+#else
+#include <spawn.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#if defined __linux__
+#include <sys/inotify.h>
+#endif
+extern char **environ;
+#endif
 
 // TODO: Make a loggin system
 
@@ -53,15 +96,110 @@ struct Option{
 
 };
 
+// proc --------------------------------------------------
+// Portable process spawning. On windows this is CreateProcessA, everywhere else
+// it's posix_spawn (vfork under the hood on glibc) and the child is waited on
+// through a pidfd when the kernel supports it.
+namespace proc {
 
-
-namespace win {
-
+#if defined USE_WINAPI
   typedef PROCESS_INFORMATION Proc;
+  typedef HANDLE Fd;
+#define INVALID_FD INVALID_HANDLE_VALUE
+#else
+  struct Proc {
+    pid_t pid{-1};
+    int pidfd{-1};
+    bool group{false}; // leads its own process group
+  };
+  typedef int Fd;
+#define INVALID_FD (-1)
+#endif
+
+  // splits a command line into argv, respecting '...' and "..." quoting
+  std::vector<std::string> split_cmd(const std::string& cmd);
+  // quotes an argument so it survives being joined into one command line
+  std::string quote_arg(const std::string& arg);
 
   int run_sync(const std::string& program, const std::string& cmd, bool new_console=false);
+  int run_sync(const std::string& program, const std::vector<std::string>& args, bool new_console=false);
   Option<Proc> run_async(const std::string& program, const std::string& cmd, bool new_console=false);
+  Option<Proc> run_async(const std::string& program, const std::vector<std::string>& args, bool new_console=false);
+  // spawns with the child's stdout and stderr redirected to `out` and its stdin to `in` (inherited if INVALID_FD).
+  // With `new_group` the child leads a new process group (a job object on windows) that
+  // whatever it starts joins, so terminate_proc can take all of them down
+  Option<Proc> spawn(const std::string& program, const std::vector<std::string>& args, bool new_console, Fd out, Fd in=INVALID_FD, bool new_group=false);
+  // spawns with the child's stdout and stderr going into a new pipe; `out` gets its read end
+  Option<Proc> spawn_piped(const std::string& program, const std::vector<std::string>& args, Fd& out, bool new_group=false);
+  // like run_sync, but the child's stdout and stderr are collected into `output`;
+  // a failure isn't reported, the caller has the output to report it with
+  int run_capture(const std::string& program, const std::vector<std::string>& args, std::string& output);
+  // like run_sync, but `input` is fed to the child's stdin
+  int run_with_input(const std::string& program, const std::vector<std::string>& args, const std::string& input);
+  // waits for the child, returns its exit code (128 + the signal if it was killed)
+  int wait_proc(const Proc& proc);
+  // wait_proc, and complains if the exit code isn't 0
   int close_proc(const Proc& proc);
+
+  struct Usage {
+    double cpu_ms{0};     // user + system
+    uint64_t peak_rss{0}; // bytes
+  };
+  // what the last child close_proc reaped on this thread used
+  Usage last_usage();
+  // what this process has used so far
+  Usage self_usage();
+
+  // terminates the child (if it's still running) and reaps it quietly; on posix
+  // it's asked with SIGTERM first and gets KILL_PROC_GRACE_MS before SIGKILL
+#define KILL_PROC_GRACE_MS 2000
+  void kill_proc(const Proc& proc);
+  // terminates the child, and its group if it leads one, without reaping it; whoever waits on it still has to
+  void terminate_proc(const Proc& proc);
+} // namespace proc
+
+// os --------------------------------------------------
+namespace os {
+  void open_file(const std::string& file);
+  void open_dir(const std::string& dir);
+  // looks `program` up in PATH, returns an empty string if it can't be found
+  std::string find_program(const std::string& program);
+  // bytes of ram the machine has, 0 if it can't be told
+  uint64_t physical_memory();
+  // of this process
+  uint64_t pid();
+} // namespace os
+
+// net --------------------------------------------------
+// Blocking TCP and unix domain sockets. An address is `host:port`, `:port`
+// (every interface, to listen on) or `unix:<path>`.
+namespace net {
+#if defined USE_WINAPI
+  typedef SOCKET Socket;
+#define INVALID_SOCK INVALID_SOCKET
+#else
+  typedef int Socket;
+#define INVALID_SOCK (-1)
+#endif
+
+  // INVALID_SOCK if nothing answered within `timeout_ms`; last_error() says why
+  Socket connect(const std::string& address, int timeout_ms=2000);
+  Socket listen(const std::string& address);
+  Socket accept(Socket s);
+  bool send_all(Socket s, std::string_view data);
+  bool recv_all(Socket s, char* data, size_t size);
+  // whatever arrives first, at most `size` bytes; 0 once the other end is done, -1 on errors
+  long recv_some(Socket s, char* data, size_t size);
+  // sends and receives that take longer than `ms` fail
+  void set_timeout(Socket s, int ms);
+  // up to the next '\n', which isn't kept; false if there's none in the first `max` bytes
+  bool recv_line(Socket s, std::string& line, size_t max=256);
+  void close(Socket s);
+  std::string last_error();
+} // namespace net
+
+#if defined USE_WINAPI
+namespace win {
   HINSTANCE open_dir(const std::string& dir);
   HINSTANCE open_file(const std::string& file);
   std::string last_error_str();
@@ -84,15 +222,17 @@ namespace win {
   if (!(condition)) {                                                          \
     PANIC(msg);                                                                \
   }
-#define ERR(str, ...) PANIC("{}: "str, "ERROR", __VA_ARGS__)
-#define FMT(str, ...) std::format((str), __VA_ARGS__)
-#define PANIC(str, ...) panic(FMT("{}:{}: "str, __FILE__, __LINE__,  __VA_ARGS__))
+#define ERR(str, ...) PANIC("{}: " str, "ERROR", ##__VA_ARGS__)
+#define FMT(str, ...) std::format((str), ##__VA_ARGS__)
+#define PANIC(str, ...) panic(FMT("{}:{}: " str, __FILE__, __LINE__, ##__VA_ARGS__))
+// runs before panic() exits, e.g. to join threads that still use static state
+extern std::function<void()> panic_hook;
 void panic();
 template <typename T, typename... Types> void panic(T arg, Types... args) {
   std::cerr << arg;
   panic(args...);
 }
-#define LOG(str, ...) log(FMT(str, __VA_ARGS__))
+#define LOG(str, ...) log(FMT(str, ##__VA_ARGS__))
 void log();
 template <typename T, typename... Types> void log(T arg, Types... args) {
   std::cout << arg;
@@ -101,9 +241,9 @@ template <typename T, typename... Types> void log(T arg, Types... args) {
 #define UNREACHABLE() PANIC("Unreachable\n")
 #define UNIMPLEMENTED() PANIC("{}() is unimplemented\n", __func__)
 // JUST USE print("WARNING: ", ...) if you want to warn
-#define FMT(str, ...) std::format((str), __VA_ARGS__)
-#define fprint(file, str, ...) __print((file), FMT((str), __VA_ARGS__))
-#define print(str, ...) fprint(std::cout, str, __VA_ARGS__)
+#define FMT(str, ...) std::format((str), ##__VA_ARGS__)
+#define fprint(file, str, ...) __print((file), FMT((str), ##__VA_ARGS__))
+#define print(str, ...) fprint(std::cout, str, ##__VA_ARGS__)
 #define TODO() PANIC("Todo reached!\n")
 
 void __print(std::ostream &file);
@@ -142,32 +282,47 @@ namespace ch {
 } // namespace ch
 
 // str --------------------------------------------------
+// Every helper is linear in the length of its input and searches with
+// std::string_view::find (memchr underneath), so they're fine on megabyte
+// depfiles and compiler logs. The ones returning a new string can't be called
+// for their side effect; use the `_in_place` variants to edit a string.
 namespace str {
 
-  std::string tolower(std::string s);
-  std::string toupper(std::string s);
-  std::string rtrim(std::string str);
-  std::string ltrim(std::string str);
-  std::string trim(std::string str);
-  std::vector<std::string> split_by(std::string str, char delim='\n', bool add_empty=false);
-  std::string lremove(std::string str, size_t n=1);
-  std::string rremove(std::string str, size_t n=1);
-  std::string lremove_until(std::string str, std::function<bool(const char&)> predecate);
-  std::string rremove_until(std::string str, std::function<bool(const char&)> predecate);
-  std::string lremove_until(std::string str, const std::string& checker);
-  std::string remove_char(std::string str, const char& ch);
-  std::string replace(std::string str, const std::string& thing, const std::string& with);
-  std::string lpop(std::string str, size_t n=1);
-  std::string rpop(std::string str, size_t n=1);
-  std::string lpop_until(std::string str, const char& ch);
-  std::string lpop_until(std::string str, std::function<bool(const char&)> predacate);
-  std::string rpop_until(std::string str, const char& ch);
-  std::string rpop_until(std::string str, std::function<bool(const char&)> predacate);
-  std::string trim_quote(std::string str);
+  [[nodiscard]] std::string tolower(std::string s);
+  [[nodiscard]] std::string toupper(std::string s);
+  [[nodiscard]] std::string rtrim(std::string_view str);
+  [[nodiscard]] std::string ltrim(std::string_view str);
+  [[nodiscard]] std::string trim(std::string_view str);
+  [[nodiscard]] std::vector<std::string> split_by(std::string_view str, char delim='\n', bool add_empty=false);
+  [[nodiscard]] std::string lremove(std::string_view str, size_t n=1);
+  [[nodiscard]] std::string rremove(std::string_view str, size_t n=1);
+  [[nodiscard]] std::string lremove_until(std::string_view str, std::function<bool(const char&)> predecate);
+  [[nodiscard]] std::string rremove_until(std::string_view str, std::function<bool(const char&)> predecate);
+  [[nodiscard]] std::string lremove_until(std::string_view str, std::string_view checker);
+  [[nodiscard]] std::string rremove_until(std::string_view str, std::string_view checker);
+  [[nodiscard]] std::string remove_char(std::string str, const char& ch);
+  [[nodiscard]] std::string replace(std::string_view str, std::string_view thing, std::string_view with);
+  [[nodiscard]] std::string lpop(std::string_view str, size_t n=1);
+  [[nodiscard]] std::string rpop(std::string_view str, size_t n=1);
+  [[nodiscard]] std::string lpop_until(std::string_view str, const char& ch);
+  [[nodiscard]] std::string lpop_until(std::string_view str, std::function<bool(const char&)> predacate);
+  [[nodiscard]] std::string rpop_until(std::string_view str, const char& ch);
+  [[nodiscard]] std::string rpop_until(std::string_view str, std::function<bool(const char&)> predacate);
+  [[nodiscard]] std::string trim_quote(std::string_view str);
+
+  // edit `str` itself, without allocating unless `replace_in_place` has to grow it
+  std::string& rtrim_in_place(std::string& str);
+  std::string& ltrim_in_place(std::string& str);
+  std::string& trim_in_place(std::string& str);
+  std::string& lremove_in_place(std::string& str, size_t n=1);
+  std::string& rremove_in_place(std::string& str, size_t n=1);
+  std::string& lremove_until_in_place(std::string& str, std::string_view checker);
+  std::string& replace_in_place(std::string& str, std::string_view thing, std::string_view with);
 } // namespace str
 
 
 // sv --------------------------------------------------
+// Same as str, but narrowing a view instead of copying.
 namespace sv {
 
   std::string_view& rtrim(std::string_view& sv);
@@ -177,8 +332,41 @@ namespace sv {
   std::string_view& rremove(std::string_view& sv, size_t size=1);
   std::string_view& lremove_until(std::string_view& sv, std::function<bool(const char&)> predecate);
   std::string_view& rremove_until(std::string_view& sv, std::function<bool(const char&)> predecate);
+  // leaves `sv` starting at the first `checker`, or untouched if there's none
   std::string_view& lremove_until(std::string_view& sv, const std::string_view& checker);
+  // leaves `sv` ending after the last `checker`, or untouched if there's none
   std::string_view& rremove_until(std::string_view& sv, const std::string_view& checker);
+  // index of the first character of `text` from `from` on that is in `set`, 32 or 16 bytes at a time
+  size_t find_first_of(std::string_view text, std::string_view set, size_t from=0);
+
+  // Splits `text` on any of `delims` as it's iterated, the fields are views into
+  // `text` so it has to outlive them. Delimiters between two of the same `quotes`
+  // don't end a field (a backslash escapes the quote inside) and a field that's
+  // quoted as a whole comes without its quotes.
+  //   for (std::string_view line : sv::split(text, "\r\n")) ...
+  struct Split {
+    std::string_view text{};
+    std::string_view delims{};
+    std::string_view quotes{};
+    bool add_empty{false};
+    std::string stops{}; // delims and quotes, what the scan stops at
+
+    struct iterator {
+      const Split* split{nullptr};
+      size_t pos{0};    // where the next field starts, past the end when there's none
+      std::string_view field{};
+
+      std::string_view operator*() const { return field; }
+      iterator& operator++();
+      bool operator==(const iterator& other) const { return split == other.split && pos == other.pos; }
+    };
+
+    Split(std::string_view _text, std::string_view _delims, bool _add_empty, std::string_view _quotes);
+    iterator begin() const;
+    iterator end() const { return iterator{this, text.size() + 2}; }
+  };
+
+  Split split(std::string_view text, std::string_view delims="\n", bool add_empty=false, std::string_view quotes="");
 
 
 } // namespace sv
@@ -201,11 +389,95 @@ namespace math {
 			  const float x2, const float y2, const float w2, const float h2);
 } // namespace math
 
+// hash --------------------------------------------------
+namespace hash {
+#define FNV1A64_SEED 0xcbf29ce484222325ULL
+
+  uint64_t fnv1a64(std::string_view data, uint64_t seed=FNV1A64_SEED);
+  // XXH64, several GB/s; use this one for anything bigger than a few lines
+  uint64_t xxh64(std::string_view data, uint64_t seed=0);
+  std::string to_hex(uint64_t h);
+} // namespace hash
+
+// lz4 --------------------------------------------------
+// LZ4 block format, fast to decompress and good enough on object files.
+namespace lz4 {
+  std::string compress(std::string_view src);
+  // `original_size` has to be stored alongside the compressed data; returns false if `src` is corrupt
+  bool decompress(std::string_view src, size_t original_size, std::string& out);
+} // namespace lz4
+
 namespace file {
+  // A whole file as a read-only view. Regular files are mapped, so reading a big
+  // one copies nothing; pipes and other files that can't be mapped are read
+  // into memory. The view is empty (and is_open() false) if it couldn't be opened.
+  // Don't map a file something may truncate while it's mapped, replace it with a rename.
+  struct MappedFile {
+    MappedFile() = default;
+    explicit MappedFile(const std::string& filename){ open(filename); }
+    ~MappedFile(){ close(); }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept { *this = std::move(other); }
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    bool open(const std::string& filename);
+    void close();
+    bool is_open() const { return opened; }
+    std::string_view view() const { return mapped ? std::string_view(data, size) : std::string_view(buf); }
+
+  private:
+    const char* data{nullptr}; // the mapping
+    size_t size{0};
+    bool mapped{false};
+    bool opened{false};
+    std::string buf{};         // what was read when it couldn't be mapped
+  };
+
+  // a copy of the whole file, complains if it couldn't be opened
   std::string slurp_file(const std::string& filename);
 
-  // database format
-  void save_data_to_file(const std::string name, const std::string& value, std::string filename, bool overwrite=false);
+  // A key-value file for metadata. Every change is a record appended to the file
+  // and everything is indexed in memory, so a lookup is a hash lookup and a change
+  // an append. Appends are buffered until flush() (or STORE_FLUSH_SIZE of them)
+  // and written with a single fsync. Every record has a checksum, so a write torn
+  // by a crash is dropped the next time it's opened. Once most of the file is
+  // overwritten or erased records, flush() rewrites it. Thread safe.
+#define STORE_HEADER "stdcpp store 1"
+#define STORE_FLUSH_SIZE (64 * 1024)
+#define STORE_COMPACT_MIN (64 * 1024) // smaller files aren't worth rewriting
+  struct Store {
+    Store() = default;
+    explicit Store(const std::string& filename){ open(filename); }
+    ~Store(){ flush(); }
+    Store(const Store&) = delete;
+    Store& operator=(const Store&) = delete;
+
+    // loads `filename`, a missing one is an empty store; false if it wasn't a store
+    bool open(const std::string& filename);
+    Option<std::string> get(const std::string& key);
+    void set(const std::string& key, std::string_view value);
+    void erase(const std::string& key);
+    size_t size();
+    // writes what changed since the last flush, false if it couldn't
+    bool flush();
+    // rewrites the file with only the live records
+    bool compact();
+
+  private:
+    std::string filename{};
+    std::unordered_map<std::string, std::string> index{};
+    std::string pending{};   // records that aren't written yet
+    uint64_t file_size{0};   // of the valid part of the file, anything after it was torn
+    uint64_t live_size{0};   // what the file would be after compact()
+    std::mutex mtx{};
+
+    static std::string record(char op, std::string_view key, std::string_view value);
+    static size_t record_size(std::string_view key, std::string_view value);
+    void append(char op, std::string_view key, std::string_view value);
+    bool flush_locked();
+    bool compact_locked();
+  };
 
 } // namespace file
 
@@ -214,19 +486,110 @@ namespace file {
 //////////////////////////////////////////////////
 #if defined STDCPP_IMPLEMENTATION || STDCPP_IMPL
 
-#if defined USE_WINAPI
+// proc --------------------------------------------------
+namespace proc {
 
-namespace win {
+  static thread_local Usage last_child_usage{};
+
+  Usage last_usage(){
+    return last_child_usage;
+  }
+
+  std::vector<std::string> split_cmd(const std::string& cmd){
+    std::vector<std::string> res{};
+    std::string cur{};
+    bool in_arg{false};
+    char quote{0};
+    for (const char& c : cmd){
+      if (quote){
+        if (c == quote) quote = 0;
+        else cur += c;
+      } else if (c == '\'' || c == '"'){
+        quote = c;
+        in_arg = true;
+      } else if (std::isspace((unsigned char)c)){
+        if (in_arg){
+          res.push_back(std::move(cur));
+          cur.clear();
+          in_arg = false;
+        }
+      } else {
+        cur += c;
+        in_arg = true;
+      }
+    }
+    if (in_arg) res.push_back(std::move(cur));
+    return res;
+  }
+
+  std::string quote_arg(const std::string& arg){
+    if (!arg.empty() && arg.find_first_of(" \t\"") == std::string::npos) return arg;
+    std::string res{"\""};
+    for (const char& c : arg){
+      if (c == '"') res += '\\';
+      res += c;
+    }
+    res += '"';
+    return res;
+  }
 
   int run_sync(const std::string& program, const std::string& cmd, bool new_console){
+    return run_sync(program, split_cmd(cmd), new_console);
+  }
+
+  Option<Proc> run_async(const std::string& program, const std::string& cmd, bool new_console){
+    return run_async(program, split_cmd(cmd), new_console);
+  }
+
+  int run_sync(const std::string& program, const std::vector<std::string>& args, bool new_console){
+    Option<Proc> p = run_async(program, args, new_console);
+    if (!p) return 1;
+    return close_proc(p.unwrap());
+  }
+
+  Option<Proc> run_async(const std::string& program, const std::vector<std::string>& args, bool new_console){
+    return spawn(program, args, new_console, INVALID_FD);
+  }
+
+#if defined USE_WINAPI
+  // children inherit every inheritable handle, so a pipe end meant for one child
+  // must not exist while another one is spawned, or the pipe never sees EOF
+  static std::recursive_mutex spawn_mtx{};
+
+  // the job objects of the children spawned with `new_group`, by process id
+  static std::mutex jobs_mtx{};
+  static std::unordered_map<DWORD, HANDLE> jobs{};
+
+  static void close_job(const Proc& proc){
+    std::lock_guard<std::mutex> lock(jobs_mtx);
+    auto it = jobs.find(proc.dwProcessId);
+    if (it == jobs.end()) return;
+    CloseHandle(it->second);
+    jobs.erase(it);
+  }
+
+  Option<Proc> spawn(const std::string& program, const std::vector<std::string>& args, bool new_console, Fd out, Fd in, bool new_group){
+    std::lock_guard<std::recursive_mutex> lock(spawn_mtx);
     STARTUPINFOA si{};
     si.cb = sizeof(si);
+    if (out != INVALID_FD || in != INVALID_FD){
+      si.dwFlags |= STARTF_USESTDHANDLES;
+      si.hStdInput = in != INVALID_FD ? in : GetStdHandle(STD_INPUT_HANDLE);
+      si.hStdOutput = out != INVALID_FD ? out : GetStdHandle(STD_OUTPUT_HANDLE);
+      si.hStdError = out != INVALID_FD ? out : GetStdHandle(STD_ERROR_HANDLE);
+    }
     Proc child_proc;
-    
-    std::string full_cmd = FMT("{} {}", program, cmd).c_str();
+
+    std::string full_cmd = quote_arg(program);
+    for (auto& a : args){
+      full_cmd += " ";
+      full_cmd += quote_arg(a);
+    }
 
     DWORD creation_flags = NORMAL_PRIORITY_CLASS;
     if (new_console) creation_flags |= CREATE_NEW_CONSOLE;
+    // suspended until it's in the job, so nothing it starts escapes it
+    if (new_group) creation_flags |= CREATE_SUSPENDED;
 
     if (!CreateProcessA(NULL,
 			LPSTR(full_cmd.c_str()),
@@ -238,74 +601,609 @@ namespace win {
 			NULL,
 			&si,
 			&child_proc)){
-      fprint(std::cerr, "ERROR: CreateProcessA() -> {}\n",  last_error_str());
+      fprint(std::cerr, "ERROR: CreateProcessA() -> {}\n",  win::last_error_str());
+      return Option<Proc>{};
+    }
+
+    if (new_group){
+      // without a job (e.g. we're in one that forbids it) only the child itself can be terminated
+      HANDLE job = CreateJobObjectA(NULL, NULL);
+      if (job && AssignProcessToJobObject(job, child_proc.hProcess)){
+	std::lock_guard<std::mutex> jobs_lock(jobs_mtx);
+	jobs[child_proc.dwProcessId] = job;
+      } else if (job){
+	CloseHandle(job);
+      }
+      ResumeThread(child_proc.hThread);
+    }
+
+    return Option<Proc>(child_proc);
+  }
+
+  Option<Proc> spawn_piped(const std::string& program, const std::vector<std::string>& args, Fd& out, bool new_group){
+    std::lock_guard<std::recursive_mutex> lock(spawn_mtx);
+    out = INVALID_FD;
+    SECURITY_ATTRIBUTES sa{sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+    HANDLE r{}, w{};
+    if (!CreatePipe(&r, &w, &sa, 0)){
+      fprint(std::cerr, "ERROR: CreatePipe() -> {}\n", win::last_error_str());
+      return Option<Proc>{};
+    }
+    // only the write end goes to the child
+    SetHandleInformation(r, HANDLE_FLAG_INHERIT, 0);
+    Option<Proc> p = spawn(program, args, false, w, INVALID_FD, new_group);
+    CloseHandle(w);
+    if (!p){
+      CloseHandle(r);
+      return p;
+    }
+    out = r;
+    return p;
+  }
+
+  int run_capture(const std::string& program, const std::vector<std::string>& args, std::string& output){
+    HANDLE r{};
+    Option<Proc> p = spawn_piped(program, args, r);
+    if (!p) return 1;
+    char buf[4096];
+    DWORD n{0};
+    while (ReadFile(r, buf, sizeof(buf), &n, NULL) && n > 0) output.append(buf, n);
+    CloseHandle(r);
+    return wait_proc(p.unwrap());
+  }
+
+  int run_with_input(const std::string& program, const std::vector<std::string>& args, const std::string& input){
+    std::unique_lock<std::recursive_mutex> lock(spawn_mtx);
+    SECURITY_ATTRIBUTES sa{sizeof(SECURITY_ATTRIBUTES), NULL, TRUE};
+    HANDLE r{}, w{};
+    if (!CreatePipe(&r, &w, &sa, 0)){
+      fprint(std::cerr, "ERROR: CreatePipe() -> {}\n", win::last_error_str());
       return 1;
     }
+    // only the read end goes to the child
+    SetHandleInformation(w, HANDLE_FLAG_INHERIT, 0);
+    Option<Proc> p = spawn(program, args, false, INVALID_FD, r);
+    CloseHandle(r);
+    lock.unlock();
+    if (!p){
+      CloseHandle(w);
+      return 1;
+    }
+    size_t written{0};
+    DWORD n{0};
+    while (written < input.size() && WriteFile(w, input.data() + written, DWORD(std::min<size_t>(input.size() - written, 1 << 20)), &n, NULL)){
+      written += n;
+    }
+    CloseHandle(w);
+    return close_proc(p.unwrap());
+  }
+
+  static Usage usage_of(HANDLE process){
+    Usage res{};
+    FILETIME created, exited, kernel, user;
+    if (GetProcessTimes(process, &created, &exited, &kernel, &user)){
+      // in 100ns ticks
+      auto ticks = [](const FILETIME& t){ return (uint64_t(t.dwHighDateTime) << 32) | t.dwLowDateTime; };
+      res.cpu_ms = double(ticks(kernel) + ticks(user)) / 10000.0;
+    }
+    PROCESS_MEMORY_COUNTERS mem{};
+    if (K32GetProcessMemoryInfo(process, &mem, sizeof(mem))) res.peak_rss = mem.PeakWorkingSetSize;
+    return res;
+  }
 
-    if (WaitForSingleObject(child_proc.hProcess, INFINITE) == WAIT_FAILED){
-      fprint(std::cerr, "ERROR: WaitForSingleObject() -> {}\n", last_error_str());
+  int wait_proc(const Proc& proc){
+    if (WaitForSingleObject(proc.hProcess, INFINITE) == WAIT_FAILED){
+      fprint(std::cerr, "ERROR: WaitForSingleObject() -> {}\n", win::last_error_str());
       return 1;
     }
-    
-    DWORD child_proc_exit_code{};
-    GetExitCodeProcess(child_proc.hProcess, &child_proc_exit_code);
-    if (child_proc_exit_code != 0){
-      fprint(std::cerr, "ERROR: Process exited with code: {}\n", child_proc_exit_code);
-      return child_proc_exit_code;
+
+    DWORD proc_exit_code{};
+    GetExitCodeProcess(proc.hProcess, &proc_exit_code);
+
+    last_child_usage = usage_of(proc.hProcess);
+
+    close_job(proc);
+    CloseHandle(proc.hProcess);
+    CloseHandle(proc.hThread);
+    return int(proc_exit_code);
+  }
+
+  void kill_proc(const Proc& proc){
+    TerminateProcess(proc.hProcess, 1);
+    WaitForSingleObject(proc.hProcess, INFINITE);
+    close_job(proc);
+    CloseHandle(proc.hProcess);
+    CloseHandle(proc.hThread);
+  }
+
+  void terminate_proc(const Proc& proc){
+    {
+      std::lock_guard<std::mutex> lock(jobs_mtx);
+      auto it = jobs.find(proc.dwProcessId);
+      if (it != jobs.end()){
+	TerminateJobObject(it->second, 1);
+	return;
+      }
     }
+    TerminateProcess(proc.hProcess, 1);
+  }
 
-    CloseHandle(child_proc.hProcess);
-    CloseHandle(child_proc.hThread);
-    return 0;
+  Usage self_usage(){
+    return usage_of(GetCurrentProcess());
+  }
+#else
+  static Usage usage_from(const rusage& ru){
+    Usage res{};
+    res.cpu_ms = double(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000.0 + double(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000.0;
+#if defined __APPLE__
+    res.peak_rss = uint64_t(ru.ru_maxrss);         // bytes
+#else
+    res.peak_rss = uint64_t(ru.ru_maxrss) * 1024;  // KiB
+#endif
+    return res;
   }
 
-  Option<Proc> run_async(const std::string& program, const std::string& cmd, bool new_console){
+  Usage self_usage(){
+    rusage ru{};
+    getrusage(RUSAGE_SELF, &ru);
+    return usage_from(ru);
+  }
 
-    STARTUPINFOA si{};
-    si.cb = sizeof(si);
-    Proc child_proc;
-    
-    std::string full_cmd = FMT("{} {}", program, cmd).c_str();
+  Option<Proc> spawn(const std::string& program, const std::vector<std::string>& args, bool new_console, Fd out, Fd in, bool new_group){
+    // argv points into the caller's strings; posix_spawn copies what it needs before returning
+    std::vector<char*> argv{};
+    argv.reserve(args.size() + 2);
+    argv.push_back((char*)program.c_str());
+    for (auto& a : args) argv.push_back((char*)a.c_str());
+    argv.push_back(nullptr);
+
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    short spawn_flags = 0;
+#if defined POSIX_SPAWN_USEVFORK
+    spawn_flags |= POSIX_SPAWN_USEVFORK;
+#endif
+#if defined POSIX_SPAWN_SETSID
+    // there is no console to hand out, so a "new console" is a new session instead
+    if (new_console) spawn_flags |= POSIX_SPAWN_SETSID;
+#endif
+    // a group of its own, with the child's pid as its id
+    if (new_group && !new_console){
+      spawn_flags |= POSIX_SPAWN_SETPGROUP;
+      posix_spawnattr_setpgroup(&attr, 0);
+    }
+    posix_spawnattr_setflags(&attr, spawn_flags);
 
-    DWORD creation_flags = NORMAL_PRIORITY_CLASS;
-    if (new_console) creation_flags |= CREATE_NEW_CONSOLE;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (out != INVALID_FD){
+      posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+      posix_spawn_file_actions_adddup2(&actions, out, STDERR_FILENO);
+    }
+    if (in != INVALID_FD){
+      posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+    }
 
-    if (!CreateProcessA(NULL,
-			LPSTR(full_cmd.c_str()),
-			NULL,
-			NULL,
-			TRUE,
-			creation_flags,
-			NULL,
-			NULL,
-			&si,
-			&child_proc)){
-      fprint(std::cerr, "ERROR: CreateProcessA() -> {}\n",  last_error_str());
+    Proc child_proc{};
+    int err = posix_spawnp(&child_proc.pid, program.c_str(), &actions, &attr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    if (err != 0){
+      fprint(std::cerr, "ERROR: posix_spawnp({}) -> {}\n", program, strerror(err));
       return Option<Proc>{};
     }
-    
+
+#if defined SYS_pidfd_open
+    child_proc.pidfd = int(syscall(SYS_pidfd_open, child_proc.pid, 0));
+#endif
+    child_proc.group = new_group && !new_console;
+
     return Option<Proc>(child_proc);
   }
 
-  int close_proc(const Proc& proc){
-    if (WaitForSingleObject(proc.hProcess, INFINITE) == WAIT_FAILED){
-      fprint(std::cerr, "ERROR: WaitForSingleObject() -> {}\n", last_error_str());
+  Option<Proc> spawn_piped(const std::string& program, const std::vector<std::string>& args, Fd& out, bool new_group){
+    out = INVALID_FD;
+    // close-on-exec, so children spawned at the same time by other threads don't keep the pipe open
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0){
+      fprint(std::cerr, "ERROR: pipe2() -> {}\n", strerror(errno));
+      return Option<Proc>{};
+    }
+    Option<Proc> p = spawn(program, args, false, fds[1], INVALID_FD, new_group);
+    close(fds[1]);
+    if (!p){
+      close(fds[0]);
+      return p;
+    }
+    out = fds[0];
+    return p;
+  }
+
+  int run_capture(const std::string& program, const std::vector<std::string>& args, std::string& output){
+    int r{-1};
+    Option<Proc> p = spawn_piped(program, args, r);
+    if (!p) return 1;
+    char buf[4096];
+    ssize_t n{0};
+    while ((n = read(r, buf, sizeof(buf))) != 0){
+      if (n < 0){
+	if (errno == EINTR) continue;
+	break;
+      }
+      output.append(buf, size_t(n));
+    }
+    close(r);
+    return wait_proc(p.unwrap());
+  }
+
+  int run_with_input(const std::string& program, const std::vector<std::string>& args, const std::string& input){
+    int fds[2];
+    if (pipe2(fds, O_CLOEXEC) != 0){
+      fprint(std::cerr, "ERROR: pipe2() -> {}\n", strerror(errno));
       return 1;
     }
-    
-    DWORD proc_exit_code{};
-    GetExitCodeProcess(proc.hProcess, &proc_exit_code);
+    Option<Proc> p = spawn(program, args, false, INVALID_FD, fds[0]);
+    close(fds[0]);
+    if (!p){
+      close(fds[1]);
+      return 1;
+    }
+    // if the child exits early the write fails with EPIPE (the caller is expected to ignore SIGPIPE)
+    size_t written{0};
+    while (written < input.size()){
+      ssize_t n = write(fds[1], input.data() + written, input.size() - written);
+      if (n < 0){
+	if (errno == EINTR) continue;
+	break;
+      }
+      written += size_t(n);
+    }
+    close(fds[1]);
+    return close_proc(p.unwrap());
+  }
+
+  int wait_proc(const Proc& proc){
+    if (proc.pidfd >= 0){
+      // the pidfd becomes readable once the child exits
+      pollfd pfd{proc.pidfd, POLLIN, 0};
+      while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {}
+      close(proc.pidfd);
+    }
+
+    int status{0};
+    rusage ru{};
+    while (wait4(proc.pid, &status, 0, &ru) < 0){
+      if (errno == EINTR) continue;
+      fprint(std::cerr, "ERROR: wait4() -> {}\n", strerror(errno));
+      return 1;
+    }
+    last_child_usage = usage_from(ru);
+
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return 0;
+  }
+
+  void kill_proc(const Proc& proc){
+    kill(proc.pid, SIGTERM);
+    int status{0};
+    bool reaped = false;
+    if (proc.pidfd >= 0){
+      // readable once the child exits
+      pollfd pfd{proc.pidfd, POLLIN, 0};
+      int r{0};
+      while ((r = poll(&pfd, 1, KILL_PROC_GRACE_MS)) < 0 && errno == EINTR) {}
+      if (r <= 0) kill(proc.pid, SIGKILL);
+    } else {
+      for (int waited = 0; !reaped; waited += 10){
+	pid_t r = waitpid(proc.pid, &status, WNOHANG);
+	if (r == proc.pid || (r < 0 && errno != EINTR)) reaped = true;
+	else if (waited >= KILL_PROC_GRACE_MS){
+	  kill(proc.pid, SIGKILL);
+	  break;
+	}
+	else usleep(10 * 1000);
+      }
+    }
+    if (!reaped) while (waitpid(proc.pid, &status, 0) < 0 && errno == EINTR) {}
+    if (proc.pidfd >= 0) close(proc.pidfd);
+  }
+
+  void terminate_proc(const Proc& proc){
+    // the group outlives its leader while anything in it is left, and its id isn't reused until then
+    kill(proc.group ? -proc.pid : proc.pid, SIGKILL);
+  }
+#endif
+
+  int close_proc(const Proc& proc){
+    int proc_exit_code = wait_proc(proc);
     if (proc_exit_code != 0){
       fprint(std::cerr, "ERROR: Process exited with code: {}\n", proc_exit_code);
-      return proc_exit_code;
     }
+    return proc_exit_code;
+  }
 
-    CloseHandle(proc.hProcess);
-    CloseHandle(proc.hThread);
-    
-    return 0;
+} // namespace proc
+
+// os --------------------------------------------------
+namespace os {
+  void open_file(const std::string& file){
+#if defined USE_WINAPI
+    win::open_file(file);
+#else
+    Option<proc::Proc> p = proc::run_async("xdg-open", std::vector<std::string>{file});
+    if (!p) ERR("Could not open `{}`\n", file);
+    proc::close_proc(p.unwrap());
+#endif
+  }
+
+  void open_dir(const std::string& dir){
+    open_file(dir);
+  }
+
+  std::string find_program(const std::string& program){
+    fs::path p{program};
+    if (p.has_parent_path()){
+      return fs::exists(p) ? p.string() : std::string{};
+    }
+#if defined USE_WINAPI
+    const char sep = ';';
+    const std::vector<std::string> exts = {"", ".exe", ".bat", ".cmd"};
+#else
+    const char sep = ':';
+    const std::vector<std::string> exts = {""};
+#endif
+    std::string path = get_env("PATH");
+    size_t start{0};
+    while (start <= path.size()){
+      size_t end = path.find(sep, start);
+      if (end == std::string::npos) end = path.size();
+      fs::path dir = path.substr(start, end - start);
+      if (!dir.empty()){
+        for (auto& ext : exts){
+          fs::path candidate = dir / (program + ext);
+          std::error_code ec;
+          if (fs::is_regular_file(candidate, ec)) return candidate.string();
+        }
+      }
+      start = end + 1;
+    }
+    return {};
+  }
+
+  uint64_t pid(){
+#if defined USE_WINAPI
+    return uint64_t(GetCurrentProcessId());
+#else
+    return uint64_t(getpid());
+#endif
+  }
+
+  uint64_t physical_memory(){
+#if defined USE_WINAPI
+    MEMORYSTATUSEX status{};
+    status.dwLength = sizeof(status);
+    return GlobalMemoryStatusEx(&status) ? uint64_t(status.ullTotalPhys) : 0;
+#else
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long page_size = sysconf(_SC_PAGE_SIZE);
+    return pages > 0 && page_size > 0 ? uint64_t(pages) * uint64_t(page_size) : 0;
+#endif
+  }
+} // namespace os
+
+// net --------------------------------------------------
+namespace net {
+#if defined USE_WINAPI
+#if defined _MSC_VER
+#pragma comment(lib, "ws2_32.lib")
+#endif
+  static bool startup(){
+    static const bool ok = [](){
+      WSADATA data{};
+      return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+    }();
+    return ok;
+  }
+
+  static int poll_one(Socket s, short events, int timeout_ms){
+    WSAPOLLFD pfd{s, events, 0};
+    return WSAPoll(&pfd, 1, timeout_ms);
+  }
+
+  static void set_blocking(Socket s, bool blocking){
+    u_long mode = blocking ? 0 : 1;
+    ioctlsocket(s, FIONBIO, &mode);
+  }
+
+  static bool would_block(){ return WSAGetLastError() == WSAEWOULDBLOCK; }
+  static bool interrupted(){ return WSAGetLastError() == WSAEINTR; }
+
+  void close(Socket s){ closesocket(s); }
+
+  std::string last_error(){ return FMT("winsock error {}", WSAGetLastError()); }
+#define NET_SEND_FLAGS 0
+#else
+  static bool startup(){ return true; }
+
+  static int poll_one(Socket s, short events, int timeout_ms){
+    pollfd pfd{s, events, 0};
+    int n{0};
+    while ((n = poll(&pfd, 1, timeout_ms)) < 0 && errno == EINTR) {}
+    return n;
+  }
+
+  static void set_blocking(Socket s, bool blocking){
+    const int flags = fcntl(s, F_GETFL, 0);
+    fcntl(s, F_SETFL, blocking ? flags & ~O_NONBLOCK : flags | O_NONBLOCK);
+  }
+
+  static bool would_block(){ return errno == EINPROGRESS || errno == EWOULDBLOCK; }
+  static bool interrupted(){ return errno == EINTR; }
+
+  void close(Socket s){ ::close(s); }
+
+  std::string last_error(){ return strerror(errno); }
+#if defined MSG_NOSIGNAL
+#define NET_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define NET_SEND_FLAGS 0
+#endif
+#endif
+
+  struct Endpoint {
+    int family{AF_UNSPEC};
+    sockaddr_storage addr{};
+    socklen_t len{0};
+  };
+
+  // `passive` is for listening, where `:port` means every interface
+  static bool resolve(const std::string& address, bool passive, Endpoint& res){
+    if (address.starts_with("unix:")){
+#if defined USE_WINAPI
+      return false;
+#else
+      const std::string path = address.substr(5);
+      sockaddr_un un{};
+      if (path.empty() || path.size() >= sizeof(un.sun_path)) return false;
+      un.sun_family = AF_UNIX;
+      memcpy(un.sun_path, path.c_str(), path.size() + 1);
+      memcpy(&res.addr, &un, sizeof(un));
+      res.family = AF_UNIX;
+      res.len = socklen_t(sizeof(un));
+      return true;
+#endif
+    }
+    const size_t colon = address.rfind(':');
+    if (colon == std::string::npos) return false;
+    std::string host = address.substr(0, colon);
+    const std::string port = address.substr(colon + 1);
+    // [::1]:port
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') host = host.substr(1, host.size() - 2);
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (passive) hints.ai_flags = AI_PASSIVE;
+    addrinfo* found{nullptr};
+    if (getaddrinfo(host.empty() ? (passive ? nullptr : "localhost") : host.c_str(), port.c_str(), &hints, &found) != 0 || !found) return false;
+    res.family = found->ai_family;
+    res.len = socklen_t(found->ai_addrlen);
+    memcpy(&res.addr, found->ai_addr, found->ai_addrlen);
+    freeaddrinfo(found);
+    return true;
+  }
+
+  // small requests and replies go out right away instead of waiting to be coalesced
+  static void no_delay(Socket s, int family){
+    if (family == AF_UNIX) return;
+    int one{1};
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one));
+  }
+
+  Socket connect(const std::string& address, int timeout_ms){
+    Endpoint ep{};
+    if (!startup() || !resolve(address, false, ep)) return INVALID_SOCK;
+    Socket s = socket(ep.family, SOCK_STREAM, 0);
+    if (s == INVALID_SOCK) return s;
+    set_blocking(s, false);
+    if (::connect(s, (const sockaddr*)&ep.addr, ep.len) != 0){
+      int err{0};
+      socklen_t len = sizeof(err);
+      if (!would_block() || poll_one(s, POLLOUT, timeout_ms) <= 0 ||
+	  getsockopt(s, SOL_SOCKET, SO_ERROR, (char*)&err, &len) != 0 || err != 0){
+	close(s);
+	return INVALID_SOCK;
+      }
+    }
+    set_blocking(s, true);
+    no_delay(s, ep.family);
+    return s;
+  }
+
+  Socket listen(const std::string& address){
+    Endpoint ep{};
+    if (!startup() || !resolve(address, true, ep)) return INVALID_SOCK;
+    Socket s = socket(ep.family, SOCK_STREAM, 0);
+    if (s == INVALID_SOCK) return s;
+    if (ep.family == AF_UNIX){
+      // left behind by a worker that didn't get to clean up
+      std::error_code ec;
+      fs::remove(address.substr(5), ec);
+    } else {
+      int one{1};
+      setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (const char*)&one, sizeof(one));
+    }
+    if (bind(s, (const sockaddr*)&ep.addr, ep.len) != 0 || ::listen(s, SOMAXCONN) != 0){
+      close(s);
+      return INVALID_SOCK;
+    }
+    return s;
+  }
+
+  Socket accept(Socket s){
+    Socket res{INVALID_SOCK};
+    sockaddr_storage addr{};
+    socklen_t len = sizeof(addr);
+    while ((res = ::accept(s, (sockaddr*)&addr, &len)) == INVALID_SOCK && interrupted()) {}
+    if (res != INVALID_SOCK) no_delay(res, addr.ss_family);
+    return res;
+  }
+
+  bool send_all(Socket s, std::string_view data){
+    while (!data.empty()){
+      const auto n = send(s, data.data(), int(std::min<size_t>(data.size(), 1 << 30)), NET_SEND_FLAGS);
+      if (n < 0 && interrupted()) continue;
+      if (n <= 0) return false;
+      data.remove_prefix(size_t(n));
+    }
+    return true;
+  }
+
+  bool recv_all(Socket s, char* data, size_t size){
+    while (size){
+      const auto n = recv(s, data, int(std::min<size_t>(size, 1 << 30)), 0);
+      if (n < 0 && interrupted()) continue;
+      if (n <= 0) return false;
+      data += n;
+      size -= size_t(n);
+    }
+    return true;
   }
 
+  long recv_some(Socket s, char* data, size_t size){
+    for (;;){
+      const auto n = recv(s, data, int(std::min<size_t>(size, 1 << 30)), 0);
+      if (n < 0 && interrupted()) continue;
+      return long(n);
+    }
+  }
+
+  void set_timeout(Socket s, int ms){
+#if defined USE_WINAPI
+    DWORD t = DWORD(ms);
+#else
+    timeval t{ms / 1000, (ms % 1000) * 1000};
+#endif
+    setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, (const char*)&t, sizeof(t));
+    setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, (const char*)&t, sizeof(t));
+  }
+
+  bool recv_line(Socket s, std::string& line, size_t max){
+    line.clear();
+    char c{0};
+    while (line.size() < max){
+      if (!recv_all(s, &c, 1)) return false;
+      if (c == '\n') return true;
+      line += c;
+    }
+    return false;
+  }
+} // namespace net
+
+#if defined USE_WINAPI
+
+namespace win {
+
   HINSTANCE open_dir(const std::string& dir){
     return open_file(dir);
   }
@@ -416,9 +1314,18 @@ void __print(std::ostream &file){};
 
 void log(){};
 
-void panic() { exit(1); };
+std::function<void()> panic_hook{};
+
+void panic() {
+  if (panic_hook) panic_hook();
+  exit(1);
+};
 
 std::string get_env(const std::string& value){
+#if !defined _MSC_VER
+  const char* v = std::getenv(value.c_str());
+  return v ? std::string(v) : std::string{};
+#else
   getenv_s(&__env_size, (char*)__env_buf.c_str(), MAX_ENV_SIZE, value.c_str());
   if (__env_size > 0){
     __env_buf.resize(__env_size-1);
@@ -427,6 +1334,7 @@ std::string get_env(const std::string& value){
   }
   std::string res = __env_buf;
   return res;
+#endif
 }
 
 // Arg --------------------------------------------------
@@ -449,11 +1357,11 @@ std::string Arg::pop() {
 
   if (arg[0] == '\''){
     evaluating_quote = true;
-    str::lremove(arg);
+    str::lremove_in_place(arg);
   }
-  if (arg.back() == '\''){
+  if (!arg.empty() && arg.back() == '\''){
     evaluating_quote = false;
-    str::rremove(arg);
+    str::rremove_in_place(arg);
   }
 
   *argc = *argc - 1;
@@ -487,183 +1395,142 @@ namespace str {
     return s;
   }
 
-  std::string rtrim(std::string str){
-    while (!str.empty() && (std::isspace(str[str.size()-1]) || str[str.size()-1] == '\0')){
-      str.pop_back();
-    }
-    return str;
-  }
+  std::string rtrim(std::string_view str){ return std::string(sv::rtrim(str)); }
+  std::string ltrim(std::string_view str){ return std::string(sv::ltrim(str)); }
+  std::string trim(std::string_view str){ return std::string(sv::trim(str)); }
 
-  std::string ltrim(std::string str){
-    while (!str.empty() && (std::isspace(str[0]) || str[0] == '\0')){
-      str = str.substr(1);
-    }
-    return str;
-  }
-
-  std::string trim(std::string str){return rtrim(ltrim(str)); }
-
-  std::vector<std::string> split_by(std::string str, char delim, bool add_empty){
-    std::string elm{};
+  std::vector<std::string> split_by(std::string_view str, char delim, bool add_empty){
     std::vector<std::string> res{};
-
-    std::string::size_type nl_pos{0};
-    while (nl_pos != std::string::npos){
-      nl_pos = str.find(delim);
-      elm = str.substr(0, nl_pos);
-      str = str.substr(nl_pos+1);
-      if (!add_empty){
-	if (!str.empty()){
-	  res.push_back(elm);
-	}
-      } else {
-	res.push_back(elm);
-      }
-    }
-
+    for (std::string_view elm : sv::split(str, std::string_view(&delim, 1), add_empty)) res.emplace_back(elm);
     return res;
   }
 
-  std::string lremove(std::string str, size_t n){
-    if (str.empty()) return str;
-    if (n > str.size()) n = str.size();
-    while (n > 0){
-      str = str.substr(1);
-      n--;
-    }
-    return str;
-  }
+  std::string lremove(std::string_view str, size_t n){ return std::string(sv::lremove(str, n)); }
+  std::string rremove(std::string_view str, size_t n){ return std::string(sv::rremove(str, n)); }
 
-  std::string rremove(std::string str, size_t n){
-    if (str.empty()) return str;
-    if (n > str.size()) n = str.size();
-    while (n > 0){
-      str.pop_back();
-      n--;
-    }
-    return str;
+  std::string lremove_until(std::string_view str, std::function<bool(const char&)> predecate){
+    return std::string(sv::lremove_until(str, predecate));
   }
 
-  std::string lremove_until(std::string str, std::function<bool(const char&)> predecate){
-    while (predecate(str[0]) && !str.empty()){
-      lremove(str);
-    }
-    return str;
+  std::string rremove_until(std::string_view str, std::function<bool(const char&)> predecate){
+    return std::string(sv::rremove_until(str, predecate));
   }
 
-  std::string rremove_until(std::string str, std::function<bool(const char&)> predecate){
-    while (predecate(str[str.size()-1]) && !str.empty()){
-      rremove(str);
-    }
-    return str;
+  std::string lremove_until(std::string_view str, std::string_view checker){
+    return std::string(sv::lremove_until(str, checker));
   }
 
-  std::string lremove_until(std::string str, const std::string& checker){
-    if (checker.size() > str.size() || str.empty() || checker.empty()) return str;
+  std::string rremove_until(std::string_view str, std::string_view checker){
+    return std::string(sv::rremove_until(str, checker));
+  }
 
-    std::string s{};
-    size_t s_i{0};
-    while (s_i + checker.size() < str.size()){
-      s = str.substr(s_i, checker.size());
-      if (s == checker) break;
-      s_i++;
-    }
-    str = str.substr(s_i);
+  std::string remove_char(std::string str, const char& ch){
+    std::erase(str, ch);
     return str;
   }
 
-  std::string rremove_until(std::string str, const std::string& checker){
-    if (checker.size() > str.size() || str.empty() || checker.empty()) return str;
+  std::string replace(std::string_view str, std::string_view thing, std::string_view with){
+    if (thing.empty()) return std::string(str);
 
-    std::string s{};
-    size_t s_i{str.size()};
-    while (s_i - checker.size() > 0){
-      s = str.substr(s_i - checker.size(), checker.size());
-      if (s == checker) break;
-      s_i--;
+    std::string res{};
+    res.reserve(str.size());
+    size_t last{0};
+    for (size_t pos = str.find(thing); pos != std::string_view::npos; pos = str.find(thing, last)){
+      res.append(str.substr(last, pos - last));
+      res.append(with);
+      last = pos + thing.size();
     }
-    str = str.substr(0, s_i);
-    return str;
+    res.append(str.substr(last));
+
+    return res;
   }
 
-  std::string remove_char(std::string str, const char& ch){
-    auto ch_pos = str.find(ch);
-    while (ch_pos != std::string::npos){
-      str.erase(ch_pos, 1);
-      ch_pos = str.find(ch);
-    }
+  std::string lpop(std::string_view str, size_t n){
+    return std::string(str.substr(0, n));
+  }
+  std::string rpop(std::string_view str, size_t n){
+    return std::string(str.substr(str.size() - std::min(n, str.size())));
+  }
 
-    return str;
+  std::string lpop_until(std::string_view str, const char& ch){
+    return std::string(str.substr(0, str.find(ch)));
   }
 
-  std::string replace(std::string str, const std::string& thing, const std::string& with){
-    auto thing_pos{str.find(thing)};
+  std::string lpop_until(std::string_view str, std::function<bool(const char&)> predacate){
+    size_t i = 0;
+    while (i < str.size() && !predacate(str[i])) i++;
+    return std::string(str.substr(0, i));
+  }
 
-    while (thing_pos != std::string::npos){
-      std::string before_thing{str.substr(0, thing_pos)};
-      std::string after_thing{str.substr(thing_pos)};
-      str::lremove(after_thing, thing.size());
-      str = before_thing + with + after_thing;
-      thing_pos = str.find(thing, before_thing.size() + with.size());
+  std::string rpop_until(std::string_view str, const char& ch){
+    auto ch_idx = str.rfind(ch);
+    if (ch_idx == std::string_view::npos){
+      return std::string(str);
     }
 
-    return str;
+    return std::string(str.substr(ch_idx+1));
   }
 
-  // TODO: Maybe pass the str by reference? because if it's passed by value we can essentially just use std::string::substr() instead.
-  std::string lpop(std::string str, size_t n){
-    return str.substr(0, n);
-  }
-  std::string rpop(std::string str, size_t n){
-    return str.substr(str.size() - n);
+  std::string trim_quote(std::string_view str){
+    if (!str.empty() && str[0] == '\'') str.remove_prefix(1);
+    if (!str.empty() && str[str.size()-1] == '\'') str.remove_suffix(1);
+    return std::string(str);
   }
 
-  std::string lpop_until(std::string str, const char& ch){
-    auto ch_idx = str.find_first_of(ch);
-    if (ch_idx == std::string::npos){
-      return str;
-    }
+  std::string rpop_until(std::string_view str, std::function<bool(const char&)> predacate){
+    size_t i = str.size();
+    while (i > 0 && !predacate(str[i-1])) i--;
+    return std::string(str.substr(i));
+  }
 
-    return str.substr(0, ch_idx);
+  std::string& rtrim_in_place(std::string& str){
+    std::string_view v{str};
+    str.resize(sv::rtrim(v).size());
+    return str;
   }
 
-  std::string lpop_until(std::string str, std::function<bool(const char&)> predacate){
-    size_t i = 0;
-    while (i < str.size()){
-      if (!predacate(str[i])){
-	i++;
-      } else {
-	return str.substr(0, i);
-      }
-    }
+  std::string& ltrim_in_place(std::string& str){
+    std::string_view v{str};
+    str.erase(0, str.size() - sv::ltrim(v).size());
     return str;
   }
 
-  std::string rpop_until(std::string str, const char& ch){
-    auto ch_idx = str.find_last_of(ch);
-    if (ch_idx == std::string::npos){
-      return str;
-    }
+  std::string& trim_in_place(std::string& str){ return ltrim_in_place(rtrim_in_place(str)); }
 
-    return str.substr(ch_idx+1);
+  std::string& lremove_in_place(std::string& str, size_t n){
+    str.erase(0, std::min(n, str.size()));
+    return str;
   }
 
-  std::string trim_quote(std::string str){
-    if (str.empty()) return {};
-    if (str[0] == '\'') str = lremove(str);
-    if (str[str.size()-1] == '\'') str = rremove(str);
+  std::string& rremove_in_place(std::string& str, size_t n){
+    str.resize(str.size() - std::min(n, str.size()));
     return str;
   }
 
-  std::string rpop_until(std::string str, std::function<bool(const char&)> predacate){
-    size_t i = str.size()-1;
-    while (i >= 0){
-      if (!predacate(str[i])){
-	i--;
-      } else {
-	return str.substr(i+1);
-      }
+  std::string& lremove_until_in_place(std::string& str, std::string_view checker){
+    std::string_view v{str};
+    str.erase(0, str.size() - sv::lremove_until(v, checker).size());
+    return str;
+  }
+
+  std::string& replace_in_place(std::string& str, std::string_view thing, std::string_view with){
+    if (thing.empty()) return str;
+    size_t pos = str.find(thing);
+    if (pos == std::string::npos) return str;
+    if (with.size() > thing.size()) return str = replace(str, thing, with);
+
+    // never longer than before, so shift what follows every match down as we go
+    size_t out{pos};
+    while (pos != std::string::npos){
+      std::memmove(str.data() + out, with.data(), with.size());
+      out += with.size();
+      const size_t from = pos + thing.size();
+      pos = str.find(thing, from);
+      const size_t len = (pos == std::string::npos ? str.size() : pos) - from;
+      std::memmove(str.data() + out, str.data() + from, len);
+      out += len;
     }
+    str.resize(out);
     return str;
   }
 
@@ -672,76 +1539,143 @@ namespace str {
 // sv --------------------------------------------------
 namespace sv{
 
+static bool is_blank(char c){ return std::isspace((unsigned char)c) || c == '\0'; }
+
 std::string_view& rtrim(std::string_view& sv){
-  while (!sv.empty() && (std::isspace(sv[sv.size()-1]) || sv[sv.size()-1] == '\0')){
-    sv.remove_suffix(1);
-  }
+  size_t n = sv.size();
+  while (n > 0 && is_blank(sv[n-1])) n--;
+  sv.remove_suffix(sv.size() - n);
   return sv;
 }
 
 std::string_view& ltrim(std::string_view& sv){
-  while (!sv.empty() && (std::isspace(sv[0]) || sv[0] == '\0')){
-    sv.remove_prefix(1);
-  }
+  size_t n = 0;
+  while (n < sv.size() && is_blank(sv[n])) n++;
+  sv.remove_prefix(n);
   return sv;
 }
 
 std::string_view& trim(std::string_view& sv){return rtrim(ltrim(sv)); }
 
 std::string_view& lremove(std::string_view& sv, size_t size){
-  if (sv.empty()) return sv;
-  if (size > sv.size()) size = sv.size();
-  sv.remove_prefix(size);
+  sv.remove_prefix(std::min(size, sv.size()));
   return sv;
 }
 
 std::string_view& rremove(std::string_view& sv, size_t size){
-  if (sv.empty()) return sv;
-  if (size > sv.size()) size = sv.size();
-  sv.remove_suffix(size);
+  sv.remove_suffix(std::min(size, sv.size()));
   return sv;
 }
 
 std::string_view& lremove_until(std::string_view& sv, std::function<bool(const char&)> predecate){
-  while (predecate(sv[0])){
-    sv::lremove(sv);
-  }
+  size_t n = 0;
+  while (n < sv.size() && predecate(sv[n])) n++;
+  sv.remove_prefix(n);
   return sv;
 }
 
 std::string_view& rremove_until(std::string_view& sv, std::function<bool(const char&)> predecate){
-  while (predecate(sv[sv.size()-1])){
-    sv::rremove(sv);
-  }
+  size_t n = sv.size();
+  while (n > 0 && predecate(sv[n-1])) n--;
+  sv.remove_suffix(sv.size() - n);
   return sv;
 }
 
 std::string_view& lremove_until(std::string_view& sv, const std::string_view& checker){
-  if (checker.size() > sv.size() || sv.empty() || checker.empty()) return sv;
-
-  std::string_view s{};
-  size_t s_i{0};
-  while (s_i + checker.size() < sv.size() && s != checker){
-    s = sv.substr(s_i, checker.size());
-    s_i++;
-  }
-  sv = sv.substr(s_i-1);
+  if (checker.empty()) return sv;
+  const size_t pos = sv.find(checker);
+  if (pos != std::string_view::npos) sv.remove_prefix(pos);
   return sv;
 }
 
 std::string_view& rremove_until(std::string_view& sv, const std::string_view& checker){
-  if (checker.size() > sv.size() || sv.empty() || checker.empty()) return sv;
+  if (checker.empty()) return sv;
+  const size_t pos = sv.rfind(checker);
+  if (pos != std::string_view::npos) sv.remove_suffix(sv.size() - pos - checker.size());
+  return sv;
+}
+
+size_t find_first_of(std::string_view text, std::string_view set, size_t from){
+  if (from >= text.size() || set.empty()) return std::string_view::npos;
+  if (set.size() == 1) return text.find(set[0], from); // memchr
+  const char* data = text.data();
+  size_t i = from;
+#if defined STDCPP_AVX2
+  if (set.size() <= 16){
+    __m256i wanted[16];
+    for (size_t k = 0; k < set.size(); ++k) wanted[k] = _mm256_set1_epi8(set[k]);
+    for (; i + 32 <= text.size(); i += 32){
+      const __m256i chunk = _mm256_loadu_si256((const __m256i*)(data + i));
+      __m256i hits = _mm256_cmpeq_epi8(chunk, wanted[0]);
+      for (size_t k = 1; k < set.size(); ++k) hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(chunk, wanted[k]));
+      const uint32_t mask = uint32_t(_mm256_movemask_epi8(hits));
+      if (mask) return i + size_t(std::countr_zero(mask));
+    }
+  }
+#elif defined STDCPP_SSE2
+  if (set.size() <= 16){
+    __m128i wanted[16];
+    for (size_t k = 0; k < set.size(); ++k) wanted[k] = _mm_set1_epi8(set[k]);
+    for (; i + 16 <= text.size(); i += 16){
+      const __m128i chunk = _mm_loadu_si128((const __m128i*)(data + i));
+      __m128i hits = _mm_cmpeq_epi8(chunk, wanted[0]);
+      for (size_t k = 1; k < set.size(); ++k) hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, wanted[k]));
+      const uint32_t mask = uint32_t(_mm_movemask_epi8(hits));
+      if (mask) return i + size_t(std::countr_zero(mask));
+    }
+  }
+#endif
+  // the tail, or everything with a big set or no simd
+  bool in_set[256]{};
+  for (char c : set) in_set[(unsigned char)c] = true;
+  for (; i < text.size(); ++i){
+    if (in_set[(unsigned char)data[i]]) return i;
+  }
+  return std::string_view::npos;
+}
 
-  std::string_view s{};
-  size_t s_i{sv.size()};
+Split::Split(std::string_view _text, std::string_view _delims, bool _add_empty, std::string_view _quotes)
+  : text(_text), delims(_delims), quotes(_quotes), add_empty(_add_empty), stops(_delims) {
+  stops += _quotes;
+}
 
-  while (s_i - checker.size() >= 0){
-    s = sv.substr(s_i - checker.size(), checker.size());
-    if (s == checker) break;
-    s_i--;
+Split::iterator Split::begin() const {
+  iterator it{this, 0};
+  return ++it;
+}
+
+Split::iterator& Split::iterator::operator++(){
+  const std::string_view text = split->text;
+  while (pos <= text.size()){
+    const size_t start = pos;
+    size_t i = start;
+    bool quoted{false};
+    while ((i = find_first_of(text, split->stops, i)) != std::string_view::npos){
+      if (split->delims.find(text[i]) != std::string_view::npos) break;
+      // skip to the closing quote
+      const char quote[] = {text[i], '\\'};
+      quoted = true;
+      for (i = find_first_of(text, std::string_view(quote, 2), i + 1); i != std::string_view::npos && text[i] == '\\';){
+	i = find_first_of(text, std::string_view(quote, 2), i + 2);
+      }
+      if (i == std::string_view::npos) break;
+      ++i;
+    }
+    const size_t end = i == std::string_view::npos ? text.size() : i;
+    field = text.substr(start, end - start);
+    pos = end + 1;
+    if (quoted && field.size() >= 2 && field.front() == field.back() && split->quotes.find(field.front()) != std::string_view::npos){
+      field = field.substr(1, field.size() - 2);
+    }
+    if (split->add_empty || !field.empty()) return *this;
   }
-  sv = sv.substr(0, s_i);
-  return sv;
+  pos = text.size() + 2;
+  field = {};
+  return *this;
+}
+
+Split split(std::string_view text, std::string_view delims, bool add_empty, std::string_view quotes){
+  return Split(text, delims, add_empty, quotes);
 }
 
 
@@ -806,56 +1740,469 @@ bool rect_contains_rect(const float x1, const float y1, const float w1, const fl
 
 } // namespace math
 
+// hash --------------------------------------------------
+namespace hash {
+  uint64_t fnv1a64(std::string_view data, uint64_t seed){
+    uint64_t h = seed;
+    for (const char& c : data){
+      h ^= (unsigned char)c;
+      h *= 0x100000001b3ULL;
+    }
+    return h;
+  }
+
+  static inline uint64_t read64(const unsigned char* p){
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static inline uint32_t read32(const unsigned char* p){
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static inline uint64_t rotl64(uint64_t x, int r){ return (x << r) | (x >> (64 - r)); }
+
+#define XXH_P1 11400714785074694791ULL
+#define XXH_P2 14029467366897019727ULL
+#define XXH_P3 1609587929392839161ULL
+#define XXH_P4 9650029242287828579ULL
+#define XXH_P5 2870177450012600261ULL
+
+  static inline uint64_t xxh64_round(uint64_t acc, uint64_t input){
+    acc += input * XXH_P2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_P1;
+  }
+
+  static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val){
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_P1 + XXH_P4;
+  }
+
+  uint64_t xxh64(std::string_view data, uint64_t seed){
+    const unsigned char* p = (const unsigned char*)data.data();
+    const unsigned char* end = p + data.size();
+    uint64_t h{0};
+
+    if (data.size() >= 32){
+      uint64_t v1 = seed + XXH_P1 + XXH_P2;
+      uint64_t v2 = seed + XXH_P2;
+      uint64_t v3 = seed;
+      uint64_t v4 = seed - XXH_P1;
+      const unsigned char* limit = end - 32;
+      do {
+	v1 = xxh64_round(v1, read64(p));      p += 8;
+	v2 = xxh64_round(v2, read64(p));      p += 8;
+	v3 = xxh64_round(v3, read64(p));      p += 8;
+	v4 = xxh64_round(v4, read64(p));      p += 8;
+      } while (p <= limit);
+      h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+      h = xxh64_merge(h, v1);
+      h = xxh64_merge(h, v2);
+      h = xxh64_merge(h, v3);
+      h = xxh64_merge(h, v4);
+    } else {
+      h = seed + XXH_P5;
+    }
+
+    h += uint64_t(data.size());
+
+    while (p + 8 <= end){
+      h ^= xxh64_round(0, read64(p));
+      h = rotl64(h, 27) * XXH_P1 + XXH_P4;
+      p += 8;
+    }
+    if (p + 4 <= end){
+      h ^= uint64_t(read32(p)) * XXH_P1;
+      h = rotl64(h, 23) * XXH_P2 + XXH_P3;
+      p += 4;
+    }
+    while (p < end){
+      h ^= (*p) * XXH_P5;
+      h = rotl64(h, 11) * XXH_P1;
+      p++;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_P2;
+    h ^= h >> 29;
+    h *= XXH_P3;
+    h ^= h >> 32;
+    return h;
+  }
+
+  std::string to_hex(uint64_t h){
+    return FMT("{:016x}", h);
+  }
+} // namespace hash
+
+// lz4 --------------------------------------------------
+namespace lz4 {
+#define LZ4_MIN_MATCH 4
+#define LZ4_HASH_BITS 16
+// the format wants the last 5 bytes to be literals and the last match to start 12 bytes before the end
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT 12
+
+  static void write_length(std::string& out, size_t len){
+    while (len >= 255){
+      out += char(255);
+      len -= 255;
+    }
+    out += char(len);
+  }
+
+  static void write_sequence(std::string& out, const char* literals, size_t lit_len, size_t offset, size_t match_len){
+    const size_t ml = match_len ? match_len - LZ4_MIN_MATCH : 0;
+    out += char(((lit_len >= 15 ? 15 : lit_len) << 4) | (ml >= 15 ? 15 : ml));
+    if (lit_len >= 15) write_length(out, lit_len - 15);
+    out.append(literals, lit_len);
+    if (match_len == 0) return; // the last sequence only has literals
+    out += char(offset & 0xff);
+    out += char(offset >> 8);
+    if (ml >= 15) write_length(out, ml - 15);
+  }
+
+  std::string compress(std::string_view src){
+    std::string out{};
+    out.reserve(src.size() / 2 + 16);
+    const unsigned char* in = (const unsigned char*)src.data();
+    const size_t n = src.size();
+    std::vector<uint32_t> table(size_t(1) << LZ4_HASH_BITS, UINT32_MAX);
+
+    size_t anchor{0};
+    size_t i{0};
+    const size_t mf_limit = n > LZ4_MF_LIMIT ? n - LZ4_MF_LIMIT : 0;
+    while (i < mf_limit){
+      const uint32_t seq = hash::read32(in + i);
+      const uint32_t h = (seq * 2654435761u) >> (32 - LZ4_HASH_BITS);
+      const uint32_t ref = table[h];
+      table[h] = uint32_t(i);
+      if (ref == UINT32_MAX || i - ref > 65535 || hash::read32(in + ref) != seq){
+	i++;
+	continue;
+      }
+      size_t len = LZ4_MIN_MATCH;
+      const size_t limit = n - LZ4_LAST_LITERALS;
+      while (i + len < limit && in[ref + len] == in[i + len]) len++;
+      write_sequence(out, src.data() + anchor, i - anchor, i - ref, len);
+      i += len;
+      anchor = i;
+    }
+    write_sequence(out, src.data() + anchor, n - anchor, 0, 0);
+    return out;
+  }
+
+  bool decompress(std::string_view src, size_t original_size, std::string& out){
+    out.clear();
+    out.reserve(original_size);
+    const unsigned char* p = (const unsigned char*)src.data();
+    const unsigned char* end = p + src.size();
+    auto read_length = [&](size_t& len){
+      unsigned char b{255};
+      while (b == 255){
+	if (p >= end) return false;
+	b = *p++;
+	len += b;
+      }
+      return true;
+    };
+    while (p < end){
+      const unsigned char token = *p++;
+      size_t lit_len = token >> 4;
+      if (lit_len == 15 && !read_length(lit_len)) return false;
+      if (size_t(end - p) < lit_len || out.size() + lit_len > original_size) return false;
+      out.append((const char*)p, lit_len);
+      p += lit_len;
+      if (p == end) break; // last sequence
+      if (end - p < 2) return false;
+      const size_t offset = size_t(p[0]) | (size_t(p[1]) << 8);
+      p += 2;
+      size_t match_len = token & 15;
+      if (match_len == 15 && !read_length(match_len)) return false;
+      match_len += LZ4_MIN_MATCH;
+      if (offset == 0 || offset > out.size() || out.size() + match_len > original_size) return false;
+      // byte by byte since the match may overlap what it's copying
+      size_t from = out.size() - offset;
+      for (size_t k = 0; k < match_len; ++k) out += out[from + k];
+    }
+    return out.size() == original_size;
+  }
+} // namespace lz4
+
 namespace file {
+  MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+    if (this == &other) return *this;
+    close();
+    data = std::exchange(other.data, nullptr);
+    size = std::exchange(other.size, 0);
+    mapped = std::exchange(other.mapped, false);
+    opened = std::exchange(other.opened, false);
+    buf = std::move(other.buf);
+    return *this;
+  }
+
+#if defined USE_WINAPI
+  bool MappedFile::open(const std::string& filename){
+    close();
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+			      NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return false;
+    opened = true;
+    LARGE_INTEGER file_size{};
+    // an empty file can't be mapped, there's nothing to read from it either
+    if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0){
+      HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+      if (mapping != NULL){
+	data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping); // the view keeps it alive
+	if (data != nullptr){
+	  size = size_t(file_size.QuadPart);
+	  mapped = true;
+	  CloseHandle(file);
+	  return true;
+	}
+      }
+    }
+    // a pipe, a console or a mapping that failed
+    char chunk[64 * 1024];
+    DWORD n{0};
+    while (ReadFile(file, chunk, sizeof(chunk), &n, NULL) && n > 0) buf.append(chunk, n);
+    CloseHandle(file);
+    return true;
+  }
+
+  void MappedFile::close(){
+    if (mapped) UnmapViewOfFile(data);
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    opened = false;
+    buf.clear();
+  }
+#else
+  bool MappedFile::open(const std::string& filename){
+    close();
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    opened = true;
+    struct stat st{};
+    // /proc and friends say they're empty, so those are read too
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0){
+      void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED){
+	data = (const char*)p;
+	size = size_t(st.st_size);
+	mapped = true;
+	::close(fd); // the mapping keeps it alive
+	return true;
+      }
+    }
+    // a pipe, a character device, an empty file or a mapping that failed
+    char chunk[64 * 1024];
+    for (;;){
+      ssize_t n = read(fd, chunk, sizeof(chunk));
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) break;
+      buf.append(chunk, size_t(n));
+    }
+    ::close(fd);
+    return true;
+  }
+
+  void MappedFile::close(){
+    if (mapped) munmap((void*)data, size);
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    opened = false;
+    buf.clear();
+  }
+#endif
+
   std::string slurp_file(const std::string& filename){
-    std::ifstream ifs;
-    ifs.open(filename, std::ios::binary);
-    if (!ifs.is_open()){
+    MappedFile f(filename);
+    if (!f.is_open()){
       fprint(std::cerr, "ERROR: Could not open file `{}` for reading...\n", filename);
       return {};
     }
+    return std::string(f.view());
+  }
 
-    std::string res{};
-    ifs.seekg(0, std::ios::end);
-    res.resize(ifs.tellg());
-    ifs.seekg(0, std::ios::beg);
-
-    ifs.read((char*)res.data(), res.size());
+  // writes `data` to `path` and waits until it's on the disk
+  static bool write_synced(const std::string& path, std::string_view data, bool append){
+#if defined USE_WINAPI
+    HANDLE f = CreateFileA(path.c_str(), append ? FILE_APPEND_DATA : GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+			   append ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE) return false;
+    bool ok = true;
+    while (ok && !data.empty()){
+      DWORD n{0};
+      ok = WriteFile(f, data.data(), DWORD(std::min<size_t>(data.size(), 1 << 30)), &n, NULL);
+      data.remove_prefix(n);
+    }
+    ok = ok && FlushFileBuffers(f);
+    CloseHandle(f);
+    return ok;
+#else
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0644);
+    if (fd < 0) return false;
+    bool ok = true;
+    while (ok && !data.empty()){
+      ssize_t n = ::write(fd, data.data(), data.size());
+      if (n < 0 && errno == EINTR) continue;
+      ok = n > 0;
+      if (ok) data.remove_prefix(size_t(n));
+    }
+    ok = ok && fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#endif
+  }
 
-    ifs.close();
+  // `s <key size> <value size> <checksum>\n<key><value>\n`, `d` with an empty value erases
+  std::string Store::record(char op, std::string_view key, std::string_view value){
+    std::string res = FMT("{} {} {} {:016x}\n", op, key.size(), value.size(), hash::xxh64(value, hash::xxh64(key)));
+    res += key;
+    res += value;
+    res += '\n';
     return res;
   }
 
-  void save_data_to_file(const std::string name, const std::string& value, std::string filename, bool overwrite){
-    // check if the value already exists in file
-    std::string file = slurp_file(filename);
-    if (file.find(name) != std::string::npos){
-      if (overwrite){
-	// overwrite file
-	auto name_pos = file.find(name);
-        size_t value_pos = name_pos + name.size() + 1;
-        if (std::isspace(file[value_pos])){
-	  value_pos++;
-	}
-
+  size_t Store::record_size(std::string_view key, std::string_view value){
+    return FMT("s {} {} ", key.size(), value.size()).size() + 16 + 1 + key.size() + value.size() + 1;
+  }
 
-	// print("before_value: |{}|\n", file.substr(0, value_pos));
-	// value.size() here have to be the previous value size
-	print("after_value: |{}|\n", file.substr(value_pos+value.size()));
+  bool Store::open(const std::string& _filename){
+    std::lock_guard<std::mutex> lock(mtx);
+    filename = _filename;
+    index.clear();
+    pending.clear();
+    file_size = 0;
+    live_size = sizeof(STORE_HEADER);
+    const MappedFile f(filename);
+    if (!f.is_open()) return true;
+    std::string_view v = f.view();
+    if (!v.starts_with(STORE_HEADER "\n")) return false;
+    size_t pos = sizeof(STORE_HEADER);
+    while (pos < v.size()){
+      const size_t nl = v.find('\n', pos);
+      if (nl == std::string_view::npos) break;
+      const std::string_view head = v.substr(pos, nl - pos);
+      if (head.size() < 2 || (head[0] != 's' && head[0] != 'd')) break;
+      size_t key_size{0}, value_size{0};
+      uint64_t checksum{0};
+      const char* p = head.data() + 2;
+      const char* end = head.data() + head.size();
+      auto r = std::from_chars(p, end, key_size);
+      if (r.ec != std::errc{} || r.ptr == end) break;
+      r = std::from_chars(r.ptr + 1, end, value_size);
+      if (r.ec != std::errc{} || r.ptr == end) break;
+      r = std::from_chars(r.ptr + 1, end, checksum, 16);
+      if (r.ec != std::errc{} || r.ptr != end) break;
+      const size_t body = nl + 1;
+      if (body + key_size + value_size >= v.size() || v[body + key_size + value_size] != '\n') break;
+      const std::string_view key = v.substr(body, key_size);
+      const std::string_view value = v.substr(body + key_size, value_size);
+      if (hash::xxh64(value, hash::xxh64(key)) != checksum) break;
+      std::string k{key};
+      auto it = index.find(k);
+      if (it != index.end()) live_size -= record_size(it->first, it->second);
+      if (head[0] == 's'){
+	live_size += record_size(key, value);
+	index.insert_or_assign(std::move(k), std::string(value));
+      } else if (it != index.end()){
+	index.erase(it);
+      }
+      pos = body + key_size + value_size + 1;
+    }
+    // whatever follows the last good record gets written over
+    file_size = pos;
+    return true;
+  }
 
-	file = file.substr(0, value_pos) + value + file.substr(value_pos+value.size());
+  Option<std::string> Store::get(const std::string& key){
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = index.find(key);
+    if (it == index.end()) return {};
+    return Option<std::string>(it->second);
+  }
 
-	print("file: |{}|\n", file);
+  void Store::append(char op, std::string_view key, std::string_view value){
+    pending += record(op, key, value);
+    if (pending.size() >= STORE_FLUSH_SIZE) flush_locked();
+  }
 
-      } else {
-	print("WARNING: Ignored writing ({}: {}) because it already exists\n", name, value);
-      }
+  void Store::set(const std::string& key, std::string_view value){
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = index.find(key);
+    if (it != index.end()){
+      if (it->second == value) return;
+      live_size -= record_size(key, it->second);
+      it->second = value;
     } else {
-      file += FMT("{}: {}\n", name, value);
-      std::ofstream ofs;
-      ofs.open(filename, std::ios::binary);
-      ofs << file;
+      index.emplace(key, std::string(value));
+    }
+    live_size += record_size(key, value);
+    append('s', key, value);
+  }
+
+  void Store::erase(const std::string& key){
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = index.find(key);
+    if (it == index.end()) return;
+    live_size -= record_size(key, it->second);
+    index.erase(it);
+    append('d', key, {});
+  }
+
+  size_t Store::size(){
+    std::lock_guard<std::mutex> lock(mtx);
+    return index.size();
+  }
+
+  bool Store::flush(){
+    std::lock_guard<std::mutex> lock(mtx);
+    return flush_locked();
+  }
+
+  bool Store::compact(){
+    std::lock_guard<std::mutex> lock(mtx);
+    return compact_locked();
+  }
+
+  bool Store::flush_locked(){
+    if (filename.empty() || pending.empty()) return true;
+    // a file that isn't what we loaded (torn, removed, never written) is rewritten whole
+    std::error_code ec;
+    const uint64_t on_disk = fs::exists(filename, ec) ? uint64_t(fs::file_size(filename, ec)) : 0;
+    const uint64_t grown = file_size + pending.size();
+    if (on_disk != file_size || file_size == 0 || (grown > STORE_COMPACT_MIN && grown > 2 * live_size)) return compact_locked();
+    if (!write_synced(filename, pending, true)) return false;
+    file_size = grown;
+    pending.clear();
+    return true;
+  }
+
+  bool Store::compact_locked(){
+    if (filename.empty()) return true;
+    std::string out{STORE_HEADER "\n"};
+    out.reserve(size_t(live_size));
+    for (auto& [key, value] : index) out += record('s', key, value);
+    const std::string tmp = filename + ".tmp";
+    if (!write_synced(tmp, out, false)) return false;
+    std::error_code ec;
+    fs::rename(tmp, filename, ec);
+    if (ec){
+      fs::remove(tmp, ec);
+      return false;
     }
+    file_size = out.size();
+    pending.clear();
+    return true;
   }
 } // namespace file
 
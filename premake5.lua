@@ -2,6 +2,18 @@ workspace "momobuild"
     configurations {"Debug", "Release"}
     location "build"
 
+filter "configurations:Debug"
+    runtime "Debug"
+    defines {"DEBUG"}
+    symbols "On"
+
+filter "configurations:Release"
+    runtime "Release"
+    defines {"NDEBUG"}
+    optimize "On"
+
+filter {}
+
 project "momobuild"
     kind "ConsoleApp"
     language "C++"
@@ -13,15 +25,14 @@ project "momobuild"
 files {"src/main.cpp"}
 includedirs {"include"}
 
-filter "configurations:Debug"
-    runtime "Debug"
-    defines {"DEBUG"}
-    symbols "On"
-
-filter "configurations:Release"
-    runtime "Release"
-    defines {"NDEBUG"}
-    optimize "On"
+-- times momobuild itself on generated projects, see src/bench.cpp
+project "bench"
+    kind "ConsoleApp"
+    language "C++"
+    architecture "x64"
+    cppdialect "c++latest"
+    staticruntime "On"
+    targetdir "bin/%{cfg.buildcfg}"
 
-filter {}
-----------------------------------------------------
+files {"src/bench.cpp"}
+includedirs {"include"}
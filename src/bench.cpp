@@ -0,0 +1,257 @@
+#define STDCPP_IMPLEMENTATION
+#if defined _WIN32
+#define USE_WINAPI
+#endif
+#include <stdcpp.hpp>
+#include <vector>
+#include <filesystem>
+#include <fstream>
+#include <chrono>
+namespace fs = std::filesystem;
+
+// Generates a synthetic project with the layout `momobuild init` creates and
+// times momobuild building it: from clean, with nothing to do, after touching
+// one header and after touching one source. The results are printed as JSON so
+// they can be compared across releases.
+
+#define ROOT_IDENTIFIER ".topdir"
+
+#if defined USE_WINAPI
+#define EXE_SUFFIX ".exe"
+#else
+#define EXE_SUFFIX ""
+#endif
+
+struct Shape {
+  size_t tus{200};    // translation units, not counting main.cpp
+  size_t headers{32};
+  size_t fanout{8};   // headers each translation unit includes
+  size_t depth{16};   // template instantiation depth of every header
+};
+
+struct Timing {
+  std::vector<double> runs{}; // ms
+  double cpu_ms{0};           // of the last run, as reported for the momobuild process
+  int ret{0};
+};
+
+std::string header_name(size_t i){ return FMT("h{}.hpp", i); }
+std::string source_name(size_t i){ return FMT("tu{}.cpp", i); }
+
+// the headers the `i`th translation unit includes; spread out so every header is used
+std::vector<size_t> includes_of(const Shape& shape, size_t i){
+  std::vector<size_t> res{};
+  for (size_t k = 0; k < std::min(shape.fanout, shape.headers); ++k) res.push_back((i * 7 + k) % shape.headers);
+  return res;
+}
+
+bool write_file(const fs::path& path, const std::string& content){
+  std::ofstream ofs(path, std::ios::binary);
+  if (!ofs.is_open()) return false;
+  ofs.write(content.data(), content.size());
+  return ofs.good();
+}
+
+void generate(const fs::path& dir, const Shape& shape){
+  for (auto d : {"src", "include", "bin", "build", "lib"}) fs::create_directories(dir / d);
+  bool ok = write_file(dir / ROOT_IDENTIFIER, "# generated by momobuild's bench\n");
+  ok &= write_file(dir / ".gitignore", "bin\nlib\nbuild\n");
+  ok &= write_file(dir / "premake5.lua",
+		   "workspace \"bench\"\n"
+		   "    configurations {\"Debug\", \"Release\"}\n"
+		   "    location \"build\"\n"
+		   "\n"
+		   "project \"bench\"\n"
+		   "    kind \"ConsoleApp\"\n"
+		   "    language \"C++\"\n"
+		   "    cppdialect \"c++17\"\n"
+		   "    targetdir \"bin/%{cfg.buildcfg}\"\n"
+		   "\n"
+		   "files {\"src/**.cpp\"}\n"
+		   "includedirs {\"include\"}\n"
+		   "\n"
+		   "filter \"configurations:Debug\"\n"
+		   "    defines {\"DEBUG\"}\n"
+		   "    symbols \"On\"\n"
+		   "\n"
+		   "filter \"configurations:Release\"\n"
+		   "    defines {\"NDEBUG\"}\n"
+		   "    optimize \"On\"\n"
+		   "\n"
+		   "filter {}\n");
+
+  // every header is a recursive template `depth` levels deep, so including it costs something
+  for (size_t h = 0; h < shape.headers; ++h){
+    std::string src = "#pragma once\n\n";
+    src += FMT("template <int N> struct h{}_t {{ static constexpr int value = h{}_t<N - 1>::value + {}; }};\n", h, h, h % 13 + 1);
+    src += FMT("template <> struct h{}_t<0> {{ static constexpr int value = {}; }};\n\n", h, h);
+    src += FMT("inline int h{}(){{ return h{}_t<{}>::value; }}\n", h, h, shape.depth);
+    ok &= write_file(dir / "include" / header_name(h), src);
+  }
+
+  std::string main_src{};
+  for (size_t i = 0; i < shape.tus; ++i){
+    std::string src{};
+    for (auto h : includes_of(shape, i)) src += FMT("#include <{}>\n", header_name(h));
+    src += FMT("\nint tu{}(){{\n  return 0", i);
+    for (auto h : includes_of(shape, i)) src += FMT(" + h{}()", h);
+    src += ";\n}\n";
+    ok &= write_file(dir / "src" / source_name(i), src);
+    main_src += FMT("int tu{}();\n", i);
+  }
+  main_src += "\nint main(){\n  long long sum{0};\n";
+  for (size_t i = 0; i < shape.tus; ++i) main_src += FMT("  sum += tu{}();\n", i);
+  main_src += "  return sum == 0;\n}\n";
+  ok &= write_file(dir / "src" / "main.cpp", main_src);
+  if (!ok) ERR("Could not generate the project in {}\n", dir.string());
+}
+
+// bumps the mtime of `path` past anything the last build wrote
+void touch(const fs::path& path){
+  fs::last_write_time(path, fs::file_time_type::clock::now());
+}
+
+double median(std::vector<double> v){
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  return v.size() % 2 ? v[v.size() / 2] : (v[v.size() / 2 - 1] + v[v.size() / 2]) / 2;
+}
+
+int main(int argc, char *argv[]) {
+  ARG();
+  std::string program = arg.pop();
+
+  Shape shape{};
+  size_t runs{5};
+  std::string config{"Debug"};
+  fs::path momobuild = fs::absolute(fs::path(program).parent_path() / FMT("momobuild{}", EXE_SUFFIX));
+  fs::path dir = fs::temp_directory_path() / "momobuild-bench";
+  std::string out_path{};
+  std::vector<std::string> extra_args{};
+
+  auto usage = [&](){
+    print("Usage: {} [flags] [-- momobuild_args...]\n", program);
+    print("\nFlags: \n"
+	  "    /tus <n>                 - Translation units to generate (default: {}).\n"
+	  "    /headers <n>             - Headers to generate (default: {}).\n"
+	  "    /fanout <n>              - Headers every translation unit includes (default: {}).\n"
+	  "    /depth <n>               - Template instantiation depth of every header (default: {}).\n"
+	  "    /runs <n>                - Times every scenario is repeated, clean builds included (default: {}).\n"
+	  "    /config <config>         - Configuration to build (default: {}).\n"
+	  "    /momobuild <path>        - The momobuild to measure (default: the one next to this executable).\n"
+	  "    /dir <path>              - Where to generate the project; it's removed first (default: {}).\n"
+	  "    /o <file>                - Write the JSON results to <file> instead of stdout.\n"
+	  "    /h,/?                    - Shows this.\n",
+	  shape.tus, shape.headers, shape.fanout, shape.depth, runs, config, dir.string());
+    exit(0);
+  };
+
+  auto number = [&](const std::string& flag){
+    std::string n = arg.pop();
+    try {
+      return size_t(std::stoul(n));
+    } catch (...) {
+      fprint(std::cerr, "ERROR: `{}` expects a number, got `{}`\n", flag, n);
+      exit(1);
+    }
+  };
+
+  while (arg){
+    std::string a = arg.pop();
+    if (a == "--"){
+      while (arg) extra_args.push_back(arg.pop());
+    }
+    else if (a == "/tus")       shape.tus = number(a);
+    else if (a == "/headers")   shape.headers = std::max<size_t>(1, number(a));
+    else if (a == "/fanout")    shape.fanout = number(a);
+    else if (a == "/depth")     shape.depth = number(a);
+    else if (a == "/runs")      runs = std::max<size_t>(1, number(a));
+    else if (a == "/config")    config = arg.pop();
+    else if (a == "/momobuild") momobuild = fs::absolute(arg.pop());
+    else if (a == "/dir")       dir = fs::absolute(arg.pop());
+    else if (a == "/o")         out_path = arg.pop();
+    else if (a == "/h" || a == "/?") usage();
+    else {
+      fprint(std::cerr, "ERROR: Invalid flag `{}`\n", a);
+      exit(1);
+    }
+  }
+
+  if (!fs::exists(momobuild)) ERR("Could not find momobuild at {}, pass /momobuild <path>\n", momobuild.string());
+  std::string version{};
+  proc::run_capture(momobuild.string(), {"/v"}, version);
+  version = str::trim(version);
+  if (version.starts_with("Momobuild Version ")) version = version.substr(sizeof("Momobuild Version ") - 1);
+
+  // never wipe something that isn't a generated project
+  std::error_code ec;
+  if (fs::exists(dir, ec)){
+    if (!fs::exists(dir / ROOT_IDENTIFIER, ec) || !fs::exists(dir / "src" / source_name(0), ec)){
+      ERR("{} exists and isn't a bench project, pick another /dir\n", dir.string());
+    }
+    fs::remove_all(dir);
+  }
+  generate(dir, shape);
+  const std::string og_dir = fs::current_path().string();
+  fs::current_path(dir);
+
+  std::vector<std::string> args = {"/Q", "/nocache"};
+  args.insert(args.end(), extra_args.begin(), extra_args.end());
+  args.push_back(config);
+
+  auto build = [&](Timing& t){
+    std::string output{};
+    auto start = std::chrono::steady_clock::now();
+    t.ret = proc::run_capture(momobuild.string(), args, output);
+    auto end = std::chrono::steady_clock::now();
+    t.cpu_ms = proc::last_usage().cpu_ms;
+    t.runs.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+    if (t.ret != 0) ERR("momobuild failed with code {}:\n{}\n", t.ret, output);
+  };
+
+  const char* names[] = {"clean", "noop", "header_touch", "source_touch"};
+  Timing timings[4]{};
+  for (size_t r = 0; r < runs; ++r){
+    fs::remove_all("build");
+    fs::remove_all(fs::path("bin") / config);
+    fs::create_directories("build");
+    build(timings[0]);
+    build(timings[1]);
+    touch(fs::path("include") / header_name(0));
+    build(timings[2]);
+    touch(fs::path("src") / source_name(0));
+    build(timings[3]);
+  }
+
+  // how many translation units the header touch rebuilt
+  size_t header_users{0};
+  for (size_t i = 0; i < shape.tus; ++i){
+    auto inc = includes_of(shape, i);
+    if (std::find(inc.begin(), inc.end(), 0) != inc.end()) header_users++;
+  }
+
+  std::string json = "{\n";
+  json += FMT("  \"momobuild\": \"{}\",\n", version);
+  json += FMT("  \"config\": \"{}\",\n", config);
+  json += FMT("  \"shape\": {{\"tus\": {}, \"headers\": {}, \"fanout\": {}, \"depth\": {}, \"header_touch_tus\": {}}},\n",
+	      shape.tus, shape.headers, shape.fanout, shape.depth, header_users);
+  json += FMT("  \"runs\": {},\n", runs);
+  json += "  \"results\": {\n";
+  for (size_t i = 0; i < 4; ++i){
+    const Timing& t = timings[i];
+    double sum{0};
+    for (auto& ms : t.runs) sum += ms;
+    json += FMT("    \"{}\": {{\"min_ms\": {:.3f}, \"median_ms\": {:.3f}, \"mean_ms\": {:.3f}, \"max_ms\": {:.3f}, \"cpu_ms\": {:.3f}}}{}\n",
+		names[i], *std::min_element(t.runs.begin(), t.runs.end()), median(t.runs), sum / double(t.runs.size()),
+		*std::max_element(t.runs.begin(), t.runs.end()), t.cpu_ms, i + 1 < 4 ? "," : "");
+  }
+  json += "  }\n}\n";
+
+  fs::current_path(og_dir);
+  if (out_path.empty()){
+    print("{}", json);
+  } else if (!write_file(out_path, json)){
+    ERR("Could not write {}\n", out_path);
+  }
+  return 0;
+}
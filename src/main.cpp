@@ -1,11 +1,23 @@
 #define STDCPP_IMPLEMENTATION
+#if defined _WIN32
 #define USE_WINAPI
+#endif
 #include <functional>
 #include <stdcpp.hpp>
 #include <vector>
 #include <filesystem>
 #include <fstream>
-#include <shellapi.h>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <chrono>
+#include <charconv>
+#include <random>
 namespace fs = std::filesystem;
 
 struct Subcmd {
@@ -28,65 +40,4542 @@ struct Subcmd {
 typedef Subcmd Flag;
 
 #define ROOT_IDENTIFIER ".topdir"
-#define ROOT_IDENTIFIER_TEMPLATE "# Configure the premake5 and msbuild path here if you don't have them added to your PATH.\n"\
+#define ROOT_IDENTIFIER_TEMPLATE "# Configure the paths of the tools here if you don't have them added to your PATH.\n"\
                                  "\n"\
                                  "# Lines starting with `#` are treated as comments and are ignored\n"\
                                  "\n"\
                                  "# premake5_path: c:\\path\\to\\premake5\\premake5.exe\n"\
-                                 "# msbuild_path:  c:\\path\\to\\msbuild\\msbuild.exe\n"
+                                 "# msbuild_path:  c:\\path\\to\\msbuild\\msbuild.exe\n"\
+                                 "# vcredist_path: c:\\path\\to\\VC\\Redist\\MSVC\\14.36.32532\n"\
+                                 "# cc_path:       c:\\path\\to\\cl.exe (the native build, CC overrides it)\n"\
+                                 "# cxx_path:      c:\\path\\to\\cl.exe (the native build, CXX overrides it)\n"\
+                                 "\n"\
+                                 "# linker used by the native build, mold or lld when they're around (`default` for the compiler's own)\n"\
+                                 "# linker:         lld\n"\
+                                 "# linker.Release: default\n"\
+                                 "\n"\
+                                 "# `momobuild worker`s the native build hands compiles to (MOMOBUILD_WORKERS overrides it)\n"\
+                                 "# workers: build-box:3737, 192.168.1.20\n"\
+                                 "\n"\
+                                 "# cache the native build shares objects through (MOMOBUILD_REMOTE_CACHE overrides it)\n"\
+                                 "# remote_cache: http://build-box:3738/momobuild\n"\
+                                 "\n"\
+                                 "# the applications `momobuild test` runs (default: the ones with `test` in their name)\n"\
+                                 "# tests: unit_tests, integration_tests\n"
+
+// these are looked up in the .topdir, PATH and the usual install locations (see tool_cache())
+#if defined USE_WINAPI
+#define MSBUILD_PROGRAM "MSBuild"
+#define PREMAKE5_PROGRAM "premake5"
+#define PREMAKE5_GENERATOR "vs2022"
+#define EXE_SUFFIX ".exe"
+#else
+// no msbuild outside of windows; premake generates makefiles and make builds them
+#define MSBUILD_PROGRAM "make"
+#define PREMAKE5_PROGRAM "premake5"
+#define PREMAKE5_GENERATOR "gmake2"
+#define EXE_SUFFIX ""
+#endif
+#define VCREDIST_EXE "vc_redist."
+#define GITIGNORE_TEMPLATE "bin\n"   \
+                           "lib\n"   \
+			   "build\n" \
+			   "*~\n"
+#define MSBUILD_OPTIONS "-warnAsMessage:LNK4006"
+
+#define VERSION ("0.0.4")
+
+// HOME is a environment variable defined to `C:\Users\<username>\`
+#define PREMAKE5_TEMPLATE_PATH (fs::path(get_env("HOME")) / ".emacs.d" / "snippets" / "lua-mode" / "premake5").string()
+
+static std::unordered_set<std::string> source_suffixes = {
+  ".hpp",
+  ".cpp"
+};
+
+// scheduler --------------------------------------------------
+// Work stealing thread pool. Every worker owns a deque; it pops its own work
+// from the back and, when it runs dry, steals from the front of the others.
+// Jobs submitted from inside a job go to the submitting worker's deque.
+// Jobs submitted with a priority share one queue instead, highest first;
+// a worker takes from it after its own deque and before stealing.
+
+struct Scheduler {
+  struct Worker {
+    std::mutex mtx{};
+    std::deque<std::function<void()>> jobs{};
+  };
+  struct Prioritized {
+    double priority{0};
+    size_t seq{0}; // submitted earlier goes first among equals
+    std::function<void()> job{};
+
+    bool operator<(const Prioritized& o) const { return priority != o.priority ? priority < o.priority : seq > o.seq; }
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers{};
+  std::vector<Prioritized> prioritized{}; // a heap
+  std::mutex prioritized_mtx{};
+  size_t prioritized_seq{0};
+  std::atomic<size_t> pending{0}; // submitted but not finished
+  std::atomic<size_t> queued{0};  // submitted but not started
+  std::mutex idle_mtx{};
+  std::condition_variable idle_cv{};
+  std::atomic<size_t> next_worker{0}; // for jobs submitted from outside the workers
+
+  static size_t& current_worker(){
+    static thread_local size_t index{SIZE_MAX};
+    return index;
+  }
+
+  Scheduler(size_t n){
+    if (n == 0) n = 1;
+    for (size_t i = 0; i < n; ++i) workers.push_back(std::make_unique<Worker>());
+  }
+
+  // counted before it's visible, so whoever takes and finishes it can't get there first
+  void submit(std::function<void()> job){
+    size_t w = current_worker();
+    if (w >= workers.size()) w = next_worker++ % workers.size();
+    pending++;
+    queued++;
+    {
+      std::lock_guard<std::mutex> lock(workers[w]->mtx);
+      workers[w]->jobs.push_back(std::move(job));
+    }
+    std::lock_guard<std::mutex> lock(idle_mtx);
+    idle_cv.notify_one();
+  }
+
+  void submit(std::function<void()> job, double priority){
+    pending++;
+    queued++;
+    {
+      std::lock_guard<std::mutex> lock(prioritized_mtx);
+      prioritized.push_back(Prioritized{priority, prioritized_seq++, std::move(job)});
+      std::push_heap(prioritized.begin(), prioritized.end());
+    }
+    std::lock_guard<std::mutex> lock(idle_mtx);
+    idle_cv.notify_one();
+  }
+
+  bool take(size_t self, std::function<void()>& job){
+    {
+      Worker& w = *workers[self];
+      std::lock_guard<std::mutex> lock(w.mtx);
+      if (!w.jobs.empty()){
+	job = std::move(w.jobs.back());
+	w.jobs.pop_back();
+	queued--;
+	return true;
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(prioritized_mtx);
+      if (!prioritized.empty()){
+	std::pop_heap(prioritized.begin(), prioritized.end());
+	job = std::move(prioritized.back().job);
+	prioritized.pop_back();
+	queued--;
+	return true;
+      }
+    }
+    for (size_t i = 1; i < workers.size(); ++i){
+      Worker& victim = *workers[(self + i) % workers.size()];
+      std::lock_guard<std::mutex> lock(victim.mtx);
+      if (!victim.jobs.empty()){
+	job = std::move(victim.jobs.front());
+	victim.jobs.pop_front();
+	queued--;
+	return true;
+      }
+    }
+    return false;
+  }
+
+  void work(size_t self){
+    // a scheduler may be run from inside another one's job
+    const size_t outer = current_worker();
+    current_worker() = self;
+    std::function<void()> job{};
+    while (true){
+      if (take(self, job)){
+	job();
+	job = nullptr;
+	if (--pending == 0){
+	  std::lock_guard<std::mutex> lock(idle_mtx);
+	  idle_cv.notify_all();
+	}
+	continue;
+      }
+      std::unique_lock<std::mutex> lock(idle_mtx);
+      idle_cv.wait(lock, [&](){ return pending == 0 || queued > 0; });
+      if (pending == 0) break;
+    }
+    current_worker() = outer;
+  }
+
+  // runs until every submitted job (and every job they submit) has finished
+  void run(){
+    std::vector<std::thread> threads{};
+    for (size_t i = 1; i < workers.size(); ++i) threads.emplace_back([this, i](){ work(i); });
+    work(0);
+    for (auto& t : threads) t.join();
+  }
+};
+
+// trace --------------------------------------------------
+// `/trace out.json` records every phase as a span in chrome's trace event
+// format (chrome://tracing, ui.perfetto.dev), one lane per thread. Spans
+// around a child process carry its exit code, cpu time and peak rss, the
+// others carry momobuild's own.
+
+std::string json_escape(std::string_view s){
+  std::string res{};
+  res.reserve(s.size());
+  for (const char& c : s){
+    switch (c){
+    case '"':  res += "\\\""; break;
+    case '\\': res += "\\\\"; break;
+    case '\n': res += "\\n"; break;
+    case '\r': res += "\\r"; break;
+    case '\t': res += "\\t"; break;
+    default:
+      if ((unsigned char)c < 0x20) res += FMT("\\u{:04x}", int(c));
+      else res += c;
+    }
+  }
+  return res;
+}
+
+struct Tracer {
+  std::string path{};
+  std::chrono::steady_clock::time_point start{std::chrono::steady_clock::now()};
+  std::mutex mtx{};
+  std::vector<std::string> events{};
+  std::atomic<int> next_lane{0};
+
+  bool enabled() const { return !path.empty(); }
+
+  int64_t now_us() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  // the calling thread's lane, numbered in the order threads first trace something
+  int lane(){
+    thread_local int id{-1};
+    if (id < 0){
+      id = next_lane++;
+      const std::string name = id == 0 ? std::string("main") : FMT("thread {}", id);
+      add(FMT(R"({{"name":"thread_name","ph":"M","pid":1,"tid":{},"args":{{"name":"{}"}}}})", id, name));
+    }
+    return id;
+  }
+
+  void add(std::string event){
+    std::lock_guard<std::mutex> lock(mtx);
+    events.push_back(std::move(event));
+  }
+
+  bool save(){
+    std::lock_guard<std::mutex> lock(mtx);
+    std::ofstream ofs(path, std::ios::binary);
+    if (!ofs.is_open()) return false;
+    ofs << "{\"traceEvents\":[\n";
+    for (size_t i = 0; i < events.size(); ++i) ofs << events[i] << (i + 1 < events.size() ? ",\n" : "\n");
+    ofs << "],\"displayTimeUnit\":\"ms\"}\n";
+    return ofs.good();
+  }
+
+  // also runs on exit()
+  ~Tracer(){
+    if (enabled() && !save()) fprint(std::cerr, "WARNING: Could not write {}\n", path);
+  }
+};
+
+Tracer& tracer(){
+  static Tracer t{};
+  return t;
+}
+
+// records the time between its construction and end() (or destruction); does nothing unless tracing
+struct TraceSpan {
+  std::string cat{};
+  std::string name{};
+  int64_t start{0};
+  proc::Usage before{};
+  proc::Usage child{};
+  int exit_code{0};
+  bool ran_child{false};
+  bool active{false};
+
+  TraceSpan(const std::string& cat, const std::string& name){
+    Tracer& t = tracer();
+    if (!t.enabled()) return;
+    active = true;
+    this->cat = cat;
+    this->name = name;
+    before = proc::self_usage();
+    start = t.now_us();
+  }
+
+  // call right after the child this span waited on is reaped; several children add up
+  void set_proc(int ret){
+    if (!active) return;
+    const proc::Usage u = proc::last_usage();
+    ran_child = true;
+    exit_code = ret;
+    child.cpu_ms += u.cpu_ms;
+    child.peak_rss = std::max(child.peak_rss, u.peak_rss);
+  }
+
+  // ends the span early, before an exit()
+  void end(){
+    if (!active) return;
+    active = false;
+    Tracer& t = tracer();
+    const int64_t now = t.now_us();
+    std::string args{};
+    if (ran_child){
+      args = FMT(R"("exit_code":{},"cpu_ms":{:.3f},"peak_rss":{})", exit_code, child.cpu_ms, child.peak_rss);
+    } else {
+      const proc::Usage self = proc::self_usage();
+      args = FMT(R"("cpu_ms":{:.3f},"peak_rss":{})", self.cpu_ms - before.cpu_ms, self.peak_rss);
+    }
+    const int lane = t.lane();
+    t.add(FMT(R"({{"name":"{}","cat":"{}","ph":"X","ts":{},"dur":{},"pid":1,"tid":{},"args":{{{}}}}})",
+	      json_escape(name), json_escape(cat), start, now - start, lane, args));
+  }
+
+  ~TraceSpan(){ end(); }
+};
+
+// output --------------------------------------------------
+// Children that run side by side never get the console. Their stdout and
+// stderr go into a pipe each and are buffered per job; on posix one thread
+// polls all of the pipes, on windows (anonymous pipes can't be polled) the
+// job's own thread reads its pipe. The caller prints a job's output in one
+// piece once it's done, or asks for it to be passed through line by line as
+// it comes in. While stdout is a terminal, a status line with the running
+// jobs stays at the bottom.
+
+struct OutputMux {
+  struct Job {
+    std::string buf{};
+    size_t passed{0}; // how much of buf went through already
+    bool passthrough{false};
+    bool eof{false};
+  };
+
+  bool status{false}; // draw the status line
+  std::mutex mtx{};
+  std::condition_variable cv{};
+  std::mutex console_mtx{};
+  std::vector<std::string> running{};
+  size_t done{0};
+  size_t total{0};
+  size_t status_width{0}; // of the status line on screen
+#if !defined USE_WINAPI
+  std::unordered_map<int, std::shared_ptr<Job>> jobs{}; // by the read end of their pipe
+  int wake[2]{-1, -1};
+  bool stopping{false};
+  std::thread loop{};
+  std::once_flag loop_started{};
+#endif
+
+  OutputMux(){
+#if defined USE_WINAPI
+    DWORD mode{0};
+    status = GetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), &mode);
+#else
+    status = isatty(STDOUT_FILENO);
+#endif
+  }
+
+  ~OutputMux(){
+#if !defined USE_WINAPI
+    if (!loop.joinable()) return;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      stopping = true;
+    }
+    wake_loop();
+    loop.join();
+    close(wake[0]);
+    close(wake[1]);
+#endif
+  }
+
+  static size_t terminal_width(){
+#if defined USE_WINAPI
+    CONSOLE_SCREEN_BUFFER_INFO info{};
+    if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) return size_t(info.srWindow.Right - info.srWindow.Left + 1);
+#else
+    winsize ws{};
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0) return ws.ws_col;
+#endif
+    return 80;
+  }
+
+  // both need console_mtx
+  void clear_status(){
+    if (status_width == 0) return;
+    std::cout << '\r' << std::string(status_width, ' ') << '\r';
+    status_width = 0;
+  }
+
+  void draw_status(){
+    if (!status || running.empty()) return;
+    std::string line = total ? FMT("[{}/{}] ", done, total) : std::string{};
+    for (size_t i = 0; i < running.size(); ++i) line += (i ? ", " : "") + running[i];
+    // the line must never wrap or the next clear misses part of it
+    const size_t width = terminal_width() - 1;
+    if (line.size() > width) line = line.substr(0, width > 3 ? width - 3 : 0) + "...";
+    std::cout << line << std::flush;
+    status_width = line.size();
+  }
+
+  // prints `text` in one piece, under the status line
+  void emit(const std::string& text){
+    std::lock_guard<std::mutex> lock(console_mtx);
+    clear_status();
+    std::cout << text;
+    draw_status();
+    std::cout << std::flush;
+  }
+
+  // a new batch of `n` jobs, for the counter in the status line
+  void begin(size_t n){
+    std::lock_guard<std::mutex> lock(console_mtx);
+    total = n;
+    done = 0;
+  }
+
+  // `n` more jobs came up in the current batch
+  void add(size_t n){
+    std::lock_guard<std::mutex> lock(console_mtx);
+    total += n;
+  }
+
+  // called with every chunk a job writes
+  void received(Job& job, const char* data, size_t n){
+    std::lock_guard<std::mutex> lock(mtx);
+    job.buf.append(data, n);
+    if (!job.passthrough) return;
+    // only whole lines, so passed through output interleaves by line at worst
+    size_t end = job.buf.rfind('\n');
+    if (end == std::string::npos || end + 1 <= job.passed) return;
+    emit(job.buf.substr(job.passed, end + 1 - job.passed));
+    job.passed = end + 1;
+  }
+
+#if !defined USE_WINAPI
+  void wake_loop(){
+    const char c{0};
+    while (write(wake[1], &c, 1) < 0 && errno == EINTR) {}
+  }
+
+  void poll_loop(){
+    std::vector<pollfd> fds{};
+    std::vector<std::shared_ptr<Job>> owners{};
+    static char buf[64 * 1024];
+    for (;;){
+      fds.assign(1, pollfd{wake[0], POLLIN, 0});
+      owners.assign(1, nullptr);
+      {
+	std::lock_guard<std::mutex> lock(mtx);
+	if (stopping && jobs.empty()) return;
+	for (auto& [fd, job] : jobs){
+	  fds.push_back(pollfd{fd, POLLIN, 0});
+	  owners.push_back(job);
+	}
+      }
+      if (poll(fds.data(), fds.size(), -1) < 0){
+	if (errno == EINTR) continue;
+	ERR("poll() -> {}\n", strerror(errno));
+      }
+      if (fds[0].revents){
+	char drain[64];
+	while (read(wake[0], drain, sizeof(drain)) > 0) {}
+      }
+      for (size_t i = 1; i < fds.size(); ++i){
+	if (!fds[i].revents) continue;
+	ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+	if (n > 0){
+	  received(*owners[i], buf, size_t(n));
+	} else if (n == 0 || (errno != EINTR && errno != EAGAIN)){
+	  {
+	    std::lock_guard<std::mutex> lock(mtx);
+	    jobs.erase(fds[i].fd);
+	    owners[i]->eof = true;
+	  }
+	  close(fds[i].fd);
+	  cv.notify_all();
+	}
+      }
+    }
+  }
+#endif
+
+  // runs `program` and blocks until it's done, its output ends up in
+  // `output`; with `passthrough` it's also printed line by line as it comes.
+  // With `timeout_ms` it's killed once it runs longer, `timed_out` says if it was
+  int run(const std::string& label, const std::string& program, const std::vector<std::string>& args, std::string& output, bool passthrough=false,
+	  uint32_t timeout_ms=0, bool* timed_out=nullptr){
+    proc::Fd fd{INVALID_FD};
+    // with a timeout it gets a process group of its own: whatever it started may hold
+    // the pipe too, and only once they're all killed does it close
+    Option<proc::Proc> p = proc::spawn_piped(program, args, fd, timeout_ms != 0);
+    if (!p) return 1;
+    auto job = std::make_shared<Job>();
+    job->passthrough = passthrough;
+    started(label);
+    std::mutex watch_mtx{};
+    std::condition_variable watch_cv{};
+    bool exited{false};
+    std::thread watchdog{};
+    if (timeout_ms){
+      watchdog = std::thread([&](){
+	std::unique_lock<std::mutex> lock(watch_mtx);
+	if (watch_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [&](){ return exited; })) return;
+	if (timed_out) *timed_out = true;
+	proc::terminate_proc(p.unwrap());
+      });
+    }
+#if defined USE_WINAPI
+    char buf[4096];
+    DWORD n{0};
+    while (ReadFile(fd, buf, sizeof(buf), &n, NULL) && n > 0) received(*job, buf, n);
+    CloseHandle(fd);
+#else
+    std::call_once(loop_started, [&](){
+      if (pipe2(wake, O_CLOEXEC | O_NONBLOCK) != 0) ERR("pipe2() -> {}\n", strerror(errno));
+      loop = std::thread([this](){ poll_loop(); });
+    });
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      jobs[fd] = job;
+    }
+    wake_loop();
+    {
+      std::unique_lock<std::mutex> lock(mtx);
+      cv.wait(lock, [&](){ return job->eof; });
+    }
+#endif
+    // still unreaped, so the watchdog can't hit another process that got its pid
+    if (watchdog.joinable()){
+      {
+	std::lock_guard<std::mutex> lock(watch_mtx);
+	exited = true;
+      }
+      watch_cv.notify_all();
+      watchdog.join();
+    }
+    const int ret = proc::wait_proc(p.unwrap());
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      // a last line without a newline
+      if (passthrough && job->passed < job->buf.size()) emit(job->buf.substr(job->passed) + "\n");
+      output += job->buf;
+    }
+    finished(label);
+    return ret;
+  }
+
+  // for jobs that aren't a process run(), like compiles on a worker
+  void started(const std::string& label){
+    std::lock_guard<std::mutex> lock(console_mtx);
+    running.push_back(label);
+    clear_status();
+    draw_status();
+  }
+
+  void finished(const std::string& label, bool counts=true){
+    std::lock_guard<std::mutex> lock(console_mtx);
+    auto it = std::find(running.begin(), running.end(), label);
+    if (it != running.end()) running.erase(it);
+    if (counts) done++;
+    clear_status();
+    draw_status();
+    std::cout << std::flush;
+  }
+};
+
+OutputMux& output_mux(){
+  static OutputMux mux{};
+  return mux;
+}
+
+// source scanner --------------------------------------------------
+// Walks a tree on the scheduler, one job per directory, without ever touching
+// the process' cwd. Paths come back interned and sorted, and .gitignore files
+// found on the way are honored.
+
+// matches `path` against a premake style pattern; `*` stays inside a directory, `**` doesn't
+bool glob_match(std::string_view pattern, std::string_view path){
+  size_t p{0}, s{0};
+  size_t star_p{std::string_view::npos}, star_s{0};
+  bool star_crosses_dirs{false};
+  while (s < path.size()){
+    if (p < pattern.size() && pattern[p] == '*'){
+      star_crosses_dirs = p + 1 < pattern.size() && pattern[p+1] == '*';
+      p += star_crosses_dirs ? 2 : 1;
+      star_p = p;
+      star_s = s;
+    } else if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == path[s]) && path[s] != '/'){
+      ++p; ++s;
+    } else if (p < pattern.size() && pattern[p] == '/' && path[s] == '/'){
+      ++p; ++s;
+    } else if (star_p != std::string_view::npos && (star_crosses_dirs || path[star_s] != '/')){
+      p = star_p;
+      s = ++star_s;
+    } else {
+      return false;
+    }
+  }
+  while (p < pattern.size() && pattern[p] == '*') ++p;
+  return p == pattern.size();
+}
+
+// every path handed out by the scanner lives here for the rest of the run,
+// so the same path is only ever stored once and can be passed around as a string_view
+struct PathPool {
+  std::mutex mtx{};
+  std::deque<std::string> storage{};
+  std::unordered_set<std::string_view> index{};
+
+  std::string_view intern(std::string_view path){
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = index.find(path);
+    if (it != index.end()) return *it;
+    std::string_view res = storage.emplace_back(path);
+    index.insert(res);
+    return res;
+  }
+};
+
+PathPool& path_pool(){
+  static PathPool pool{};
+  return pool;
+}
+
+struct IgnoreRule {
+  std::string base{};    // directory of the .gitignore, relative to the scan root
+  std::string pattern{};
+  bool negate{false};
+  bool dir_only{false};
+  bool anchored{false};  // has a `/`, so it's matched against the path below `base` instead of the name
+};
+
+std::vector<IgnoreRule> parse_ignore_rules(const std::string& text, const std::string& base){
+  std::vector<IgnoreRule> res{};
+  for (std::string_view l : sv::split(text)){
+    std::string line = str::trim(l);
+    if (line.empty() || line[0] == '#') continue;
+    IgnoreRule r{base};
+    if (line[0] == '!'){
+      r.negate = true;
+      line = line.substr(1);
+    }
+    if (line.ends_with('/')){
+      r.dir_only = true;
+      line.pop_back();
+    }
+    if (line.starts_with("**/") && line.find('/', 3) == std::string::npos){
+      line = line.substr(3);
+    } else if (line.find('/') != std::string::npos){
+      r.anchored = true;
+      if (line[0] == '/') line = line.substr(1);
+    }
+    if (line.empty()) continue;
+    r.pattern = line;
+    res.push_back(std::move(r));
+  }
+  return res;
+}
+
+// the last rule that matches decides, like git
+bool is_ignored(const std::vector<IgnoreRule>& rules, std::string_view rel, bool is_dir){
+  bool ignored{false};
+  const size_t slash = rel.rfind('/');
+  const std::string_view name = slash == std::string_view::npos ? rel : rel.substr(slash + 1);
+  for (auto& r : rules){
+    if (r.dir_only && !is_dir) continue;
+    if (r.anchored){
+      std::string_view sub = rel;
+      if (!r.base.empty()){
+	if (!(sub.starts_with(r.base) && sub.size() > r.base.size() && sub[r.base.size()] == '/')) continue;
+	sub = sub.substr(r.base.size() + 1);
+      }
+      if (!glob_match(r.pattern, sub)) continue;
+    } else if (!glob_match(r.pattern, name)){
+      continue;
+    }
+    ignored = !r.negate;
+  }
+  return ignored;
+}
+
+struct ScanOptions {
+  std::unordered_set<std::string> suffixes{}; // only collect files with these extensions, every file if empty
+  std::vector<std::string> excludes{};        // gitignore style patterns
+  bool read_gitignore{true};
+  bool skip_hidden{true};                     // skip files and dirs starting with `.`
+  size_t jobs{0};                             // 0 = one per core
+};
+
+// returns every file under `root`, as `root/rel` (just `rel` if root is "."), sorted
+std::vector<std::string_view> scan_tree(const fs::path& root, const ScanOptions& opts={}){
+  typedef std::shared_ptr<const std::vector<IgnoreRule>> Rules;
+  const size_t jobs = opts.jobs ? opts.jobs : std::max<size_t>(1, std::thread::hardware_concurrency());
+  const std::string prefix = (root.empty() || root == ".") ? std::string{} : root.generic_string() + "/";
+
+  Scheduler sched(jobs);
+  // one bucket per worker so collecting doesn't need a lock
+  std::vector<std::vector<std::string>> found(sched.workers.size());
+
+  std::function<void(std::string, Rules)> walk = [&](std::string rel_dir, Rules rules){
+    std::error_code ec;
+    const fs::path dir = rel_dir.empty() ? (root.empty() ? fs::path(".") : root) : root / rel_dir;
+    if (opts.read_gitignore && fs::exists(dir / ".gitignore", ec)){
+      auto more = std::make_shared<std::vector<IgnoreRule>>(*rules);
+      for (auto& r : parse_ignore_rules(file::slurp_file((dir / ".gitignore").string()), rel_dir)) more->push_back(std::move(r));
+      rules = more;
+    }
+    std::vector<std::string>& out = found[Scheduler::current_worker()];
+    for (auto it = fs::directory_iterator(dir, fs::directory_options::skip_permission_denied, ec); !ec && it != fs::directory_iterator(); it.increment(ec)){
+      const std::string name = it->path().filename().string();
+      if (opts.skip_hidden && name.starts_with(".")) continue;
+      std::string rel = rel_dir.empty() ? name : FMT("{}/{}", rel_dir, name);
+      std::error_code eec;
+      // don't follow symlinked directories, they can loop
+      const bool is_dir = it->is_directory(eec) && !it->is_symlink(eec);
+      if (is_ignored(*rules, rel, is_dir)) continue;
+      if (is_dir){
+	sched.submit([&walk, rel, rules](){ walk(rel, rules); });
+      } else if (opts.suffixes.empty() || opts.suffixes.contains(it->path().extension().string())){
+	out.push_back(prefix + rel);
+      }
+    }
+  };
+
+  auto rules = std::make_shared<std::vector<IgnoreRule>>();
+  for (auto& e : opts.excludes){
+    for (auto& r : parse_ignore_rules(e, "")) rules->push_back(std::move(r));
+  }
+  sched.submit([&walk, rules](){ walk("", rules); });
+  sched.run();
+
+  std::vector<std::string_view> res{};
+  PathPool& pool = path_pool();
+  for (auto& bucket : found){
+    for (auto& f : bucket) res.push_back(pool.intern(f));
+  }
+  std::sort(res.begin(), res.end());
+  return res;
+}
+
+// premake5.lua --------------------------------------------------
+// momobuild doesn't run lua, it only picks the bits it needs out of the file.
+
+// removes `-- comments` and `--[[ block comments ]]` that are not inside a string
+std::string lua_strip_comments(std::string_view src){
+  std::string res{};
+  res.reserve(src.size());
+  char quote{0};
+  for (size_t i = 0; i < src.size(); ++i){
+    const char c = src[i];
+    if (quote){
+      res += c;
+      if (c == '\\' && i + 1 < src.size()) res += src[++i];
+      else if (c == quote) quote = 0;
+    } else if (c == '"' || c == '\''){
+      quote = c;
+      res += c;
+    } else if (c == '-' && i + 1 < src.size() && src[i+1] == '-'){
+      if (src.compare(i, 4, "--[[") == 0){
+	size_t end = src.find("]]", i + 4);
+	i = (end == std::string::npos) ? src.size() : end + 1;
+      } else {
+	while (i < src.size() && src[i] != '\n') ++i;
+	res += '\n';
+      }
+    } else {
+      res += c;
+    }
+  }
+  return res;
+}
+
+struct LuaCall {
+  std::string key{};
+  std::vector<std::string> args{};
+  fs::path dir{}; // directory of the script the call is in
+};
+
+// collects every `key "a"`, `key {"a", "b"}` and `key("a")` call in order; only string arguments are kept
+std::vector<LuaCall> lua_calls(const std::string& src, const fs::path& dir={}){
+  std::vector<LuaCall> res{};
+  auto is_ident = [](const char& c){ return ch::isalphanum(c) || c == '_' || c == '.'; };
+  size_t i{0};
+  while (i < src.size()){
+    if (src[i] == '"' || src[i] == '\''){
+      // skip string literals that are not call arguments
+      size_t end = src.find(src[i], i + 1);
+      i = (end == std::string::npos) ? src.size() : end + 1;
+      continue;
+    }
+    if (!is_ident(src[i]) || ch::isdigit(src[i])){
+      ++i;
+      continue;
+    }
+    size_t start = i;
+    while (i < src.size() && is_ident(src[i])) ++i;
+    LuaCall call{src.substr(start, i - start), {}, dir};
+
+    size_t j = i;
+    while (j < src.size() && ch::isspace(src[j])) ++j;
+    if (j >= src.size()) break;
+    char close{0};
+    if (src[j] == '{') close = '}';
+    else if (src[j] == '(') close = ')';
+    else if (src[j] != '"' && src[j] != '\'') continue;
+    if (close) ++j;
+
+    // read string literals until the call ends
+    while (j < src.size()){
+      while (j < src.size() && (ch::isspace(src[j]) || src[j] == ',')) ++j;
+      if (j >= src.size()) break;
+      if (src[j] == '"' || src[j] == '\''){
+	const char quote = src[j];
+	size_t end = src.find(quote, j + 1);
+	if (end == std::string::npos) break;
+	call.args.push_back(src.substr(j + 1, end - j - 1));
+	j = end + 1;
+	if (!close) break;
+      } else {
+	if (src[j] == close) ++j;
+	break;
+      }
+    }
+    res.push_back(std::move(call));
+    i = j;
+  }
+  return res;
+}
+
+// collects the string arguments of every call to `key`
+std::vector<std::string> lua_call_args(const std::string& src, const std::string& key){
+  std::vector<std::string> res{};
+  for (auto& call : lua_calls(src)){
+    if (call.key == key) res.insert(res.end(), call.args.begin(), call.args.end());
+  }
+  return res;
+}
+
+// expands a `files {}` pattern relative to `base`, returns sorted generic paths relative to `base`
+std::vector<std::string> glob_files(const fs::path& base, std::string pattern){
+  std::replace(pattern.begin(), pattern.end(), '\\', '/');
+  std::vector<std::string> res{};
+  size_t wild = pattern.find_first_of("*?");
+  if (wild == std::string::npos){
+    if (fs::is_regular_file(base / pattern)) res.push_back(pattern);
+    return res;
+  }
+  // walk only the directory in front of the first wildcard
+  size_t slash = pattern.rfind('/', wild);
+  std::string prefix = slash == std::string::npos ? std::string{} : pattern.substr(0, slash);
+  const bool base_is_cwd = base.empty() || base == ".";
+  const fs::path root = prefix.empty() ? base : (base_is_cwd ? fs::path(prefix) : base / prefix);
+  std::error_code ec;
+  if (!fs::is_directory(root, ec)) return res;
+  // premake globs don't care about .gitignore
+  ScanOptions opts{};
+  opts.read_gitignore = false;
+  const std::string base_prefix = base_is_cwd ? std::string{} : base.generic_string() + "/";
+  for (auto& f : scan_tree(root, opts)){
+    std::string_view rel = f.substr(base_prefix.size());
+    if (glob_match(pattern, rel)) res.emplace_back(rel);
+  }
+  return res;
+}
+
+// premake fingerprint --------------------------------------------------
+
+// hashes everything the generated project depends on: premake5.lua and the
+// scripts it `include`s, the list of files its globs expand to, the generator
+// and the premake binary itself (its size and mtime stand in for its version)
+std::string premake_fingerprint(const std::string& premake_path, const std::string& generator){
+  uint64_t h = hash::fnv1a64(generator);
+
+  std::string premake_bin = os::find_program(premake_path);
+  std::error_code ec;
+  if (!premake_bin.empty()){
+    h = hash::fnv1a64(premake_bin, h);
+    h = hash::fnv1a64(std::to_string(fs::file_size(premake_bin, ec)), h);
+    h = hash::fnv1a64(std::to_string(fs::last_write_time(premake_bin, ec).time_since_epoch().count()), h);
+  }
+
+  std::vector<fs::path> scripts = {"premake5.lua"};
+  std::vector<fs::path> visited{};
+  while (!scripts.empty()){
+    fs::path script = scripts.back().lexically_normal();
+    scripts.pop_back();
+    if (std::find(visited.begin(), visited.end(), script) != visited.end()) continue;
+    visited.push_back(script);
+
+    const file::MappedFile script_file(script.string());
+    h = hash::fnv1a64(script.generic_string(), h);
+    h = hash::fnv1a64(script_file.view(), h);
+
+    const std::string src = lua_strip_comments(script_file.view());
+    const fs::path dir = script.parent_path();
+    for (auto& key : {"include", "dofile"}){
+      for (auto& inc : lua_call_args(src, key)){
+	fs::path p = dir / inc;
+	// `include "dir"` loads `dir/premake5.lua`
+	if (fs::is_directory(p, ec)) p /= "premake5.lua";
+	scripts.push_back(p);
+      }
+    }
+    for (auto& pattern : lua_call_args(src, "files")){
+      h = hash::fnv1a64(pattern, h);
+      for (auto& f : glob_files(dir.empty() ? fs::path(".") : dir, pattern)){
+	h = hash::fnv1a64(f, h);
+      }
+    }
+  }
+
+  return hash::to_hex(h);
+}
+
+// workspace --------------------------------------------------
+// A premake workspace as far as the native build cares. Calls are kept in the
+// order premake would see them, each tagged with the `filter` terms that were active.
+
+struct ScopedCall {
+  std::vector<std::string> filter{}; // all of them have to match; empty if no filter was active
+  LuaCall call{};
+};
+
+struct Project {
+  std::string name{};
+  std::vector<ScopedCall> calls{};
+};
+
+struct Workspace {
+  std::string name{};
+  std::vector<std::string> configurations{};
+  std::string startproject{};
+  std::vector<ScopedCall> calls{}; // workspace scope, inherited by every project
+  std::vector<Project> projects{};
+};
+
+// a project resolved for one configuration, paths are relative to the root dir
+struct ProjectConfig {
+  std::string name{};
+  std::string config{};
+  std::string kind{"ConsoleApp"};
+  std::string language{"C++"};
+  std::string cppdialect{};
+  std::string cdialect{};
+  std::string symbols{};
+  std::string optimize{};
+  std::string staticruntime{};
+  std::string targetdir{};
+  std::string targetname{};
+  std::string objdir{};
+  std::vector<std::string> files{};
+  std::vector<std::string> includedirs{};
+  std::vector<std::string> defines{};
+  std::vector<std::string> libdirs{};
+  std::vector<std::string> links{};
+  std::vector<std::string> buildoptions{};
+  std::vector<std::string> linkoptions{};
+};
+
+void parse_workspace_script(Workspace& wks, const fs::path& script, std::vector<std::string>& filter, Project*& prj){
+  std::string src = lua_strip_comments(file::MappedFile(script.string()).view());
+  std::error_code ec;
+  for (auto& call : lua_calls(src, script.parent_path())){
+    if (call.key == "include" || call.key == "dofile"){
+      for (auto& inc : call.args){
+	fs::path p = script.parent_path() / inc;
+	// `include "dir"` loads `dir/premake5.lua`
+	if (fs::is_directory(p, ec)) p /= "premake5.lua";
+	parse_workspace_script(wks, p, filter, prj);
+      }
+    } else if (call.key == "workspace" || call.key == "solution"){
+      if (!call.args.empty()) wks.name = call.args[0];
+      prj = nullptr;
+      filter.clear();
+    } else if (call.key == "project"){
+      if (call.args.empty()) continue;
+      auto it = std::find_if(wks.projects.begin(), wks.projects.end(), [&](const Project& p){ return p.name == call.args[0]; });
+      if (it == wks.projects.end()){
+	wks.projects.push_back(Project{call.args[0], {}});
+	prj = &wks.projects.back();
+      } else {
+	prj = &*it;
+      }
+      filter.clear();
+    } else if (call.key == "filter" || call.key == "configuration"){
+      filter = call.args;
+      std::erase_if(filter, [](const std::string& term){ return str::trim(term).empty(); });
+    } else if (call.key == "configurations" && !prj){
+      wks.configurations.insert(wks.configurations.end(), call.args.begin(), call.args.end());
+    } else if (call.key == "startproject"){
+      if (!call.args.empty()) wks.startproject = call.args[0];
+    } else {
+      (prj ? prj->calls : wks.calls).push_back(ScopedCall{filter, call});
+    }
+  }
+}
+
+Workspace parse_workspace(const fs::path& script="premake5.lua"){
+  if (!fs::exists(script)){
+    ERR("Could not find {}\n", script.string());
+  }
+  Workspace wks{};
+  std::vector<std::string> filter{};
+  Project* prj{nullptr};
+  parse_workspace_script(wks, script, filter, prj);
+  if (wks.configurations.empty()) wks.configurations = {"Debug", "Release"};
+  return wks;
+}
+
+#if defined USE_WINAPI
+#define HOST_SYSTEM "windows"
+#elif defined __APPLE__
+#define HOST_SYSTEM "macosx"
+#else
+#define HOST_SYSTEM "linux"
+#endif
+
+// does the filter term `filter` (e.g. "configurations:Debug" or "system:linux") apply to `config`?
+bool filter_term_matches(std::string filter, const std::string& config){
+  filter = str::tolower(filter);
+  size_t colon = filter.find(':');
+  if (colon == std::string::npos) return false;
+  std::string field = filter.substr(0, colon);
+  std::string value = filter.substr(colon + 1);
+  // `or` alternatives
+  auto any_of = [&](const std::string& wanted){
+    size_t start{0};
+    while (start <= value.size()){
+      size_t end = value.find(" or ", start);
+      if (end == std::string::npos) end = value.size();
+      if (str::trim(value.substr(start, end - start)) == wanted) return true;
+      start = end + 4;
+    }
+    return false;
+  };
+  if (field == "configurations") return any_of(str::tolower(config));
+  if (field == "system") return any_of(HOST_SYSTEM);
+  return false;
+}
+
+// premake ANDs the terms of a `filter {...}`
+bool filter_matches(const std::vector<std::string>& filter, const std::string& config){
+  return std::all_of(filter.begin(), filter.end(), [&](const std::string& term){ return filter_term_matches(term, config); });
+}
+
+ProjectConfig resolve_project(const Workspace& wks, const Project& prj, const std::string& config){
+  ProjectConfig res{};
+  res.name = prj.name;
+  res.config = config;
+  res.targetdir = FMT("bin/{}", config);
+  res.objdir = FMT("build/obj/{}/{}", config, prj.name);
+  res.targetname = prj.name;
+
+  auto expand = [&](std::string s){
+    s = str::replace(s, "%{cfg.buildcfg}", config);
+    s = str::replace(s, "%{cfg.name}", config);
+    s = str::replace(s, "%{prj.name}", prj.name);
+    s = str::replace(s, "%{wks.name}", wks.name);
+    return s;
+  };
+  auto path = [&](const LuaCall& call, const std::string& p){
+    return (call.dir / expand(p)).lexically_normal().generic_string();
+  };
+  auto apply = [&](const ScopedCall& sc){
+    if (!filter_matches(sc.filter, config)) return;
+    const LuaCall& call = sc.call;
+    if (call.args.empty()) return;
+    const std::string& k = call.key;
+    const std::string first = expand(call.args[0]);
+    if (k == "kind") res.kind = first;
+    else if (k == "language") res.language = first;
+    else if (k == "cppdialect") res.cppdialect = first;
+    else if (k == "cdialect") res.cdialect = first;
+    else if (k == "symbols") res.symbols = first;
+    else if (k == "optimize") res.optimize = first;
+    else if (k == "staticruntime") res.staticruntime = first;
+    else if (k == "targetname") res.targetname = first;
+    else if (k == "targetdir") res.targetdir = path(call, call.args[0]);
+    else if (k == "objdir"){
+      // like premake, configurations sharing an objdir get a dir each so they never compile to the same objects
+      const bool per_config = call.args[0].find("%{cfg.") != std::string::npos;
+      res.objdir = per_config ? FMT("{}/{}", path(call, call.args[0]), prj.name) : FMT("{}/{}/{}", path(call, call.args[0]), config, prj.name);
+    }
+    else if (k == "files"){
+      for (auto& a : call.args){
+	for (auto& f : glob_files(".", path(call, a))) res.files.push_back(f);
+      }
+    } else if (k == "removefiles"){
+      for (auto& a : call.args){
+	std::string pattern = path(call, a);
+	std::erase_if(res.files, [&](const std::string& f){ return glob_match(pattern, f); });
+      }
+    }
+    else if (k == "includedirs" || k == "externalincludedirs" || k == "sysincludedirs"){
+      for (auto& a : call.args) res.includedirs.push_back(path(call, a));
+    }
+    else if (k == "libdirs"){
+      for (auto& a : call.args) res.libdirs.push_back(path(call, a));
+    }
+    else if (k == "defines")      for (auto& a : call.args) res.defines.push_back(expand(a));
+    else if (k == "links")        for (auto& a : call.args) res.links.push_back(expand(a));
+    else if (k == "buildoptions") for (auto& a : call.args) res.buildoptions.push_back(expand(a));
+    else if (k == "linkoptions")  for (auto& a : call.args) res.linkoptions.push_back(expand(a));
+  };
+  for (auto& sc : wks.calls) apply(sc);
+  for (auto& sc : prj.calls) apply(sc);
+
+  // the same file may be matched by several patterns
+  std::sort(res.files.begin(), res.files.end());
+  res.files.erase(std::unique(res.files.begin(), res.files.end()), res.files.end());
+  return res;
+}
+
+// toolchain discovery --------------------------------------------------
+// Tools come from the .topdir (`premake5_path: ...`), then PATH, then the
+// places they usually get installed to. Compilers are probed for their
+// version, default include dirs and predefined macros. Lookups and probes are
+// cached in TOOLCHAIN_CACHE_PATH, a probe for as long as the binary's size and
+// mtime stay the same, so it's only paid again after the compiler changes.
+
+#define TOOLCHAIN_CACHE_PATH "build/toolchain.cache"
+#define TOOLCHAIN_CACHE_HEADER "momobuild-toolchain 2"
+#if defined USE_WINAPI
+#define NULL_DEVICE "NUL"
+#else
+#define NULL_DEVICE "/dev/null"
+#endif
+
+// the `key: value` lines of a .topdir, `#` starts a comment
+std::unordered_map<std::string, std::string> parse_topdir(const fs::path& path=ROOT_IDENTIFIER){
+  std::unordered_map<std::string, std::string> res{};
+  std::error_code ec;
+  if (!fs::exists(path, ec)) return res;
+  const std::string text = file::slurp_file(path.string());
+  for (std::string_view l : sv::split(text)){
+    std::string line = str::trim(l);
+    if (line.empty() || line[0] == '#') continue;
+    size_t colon = line.find(':');
+    if (colon == std::string::npos || colon == 0) continue;
+    std::string value = str::trim(line.substr(colon + 1));
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') value = value.substr(1, value.size() - 2);
+    res[str::trim(line.substr(0, colon))] = value;
+  }
+  return res;
+}
+
+// where `program` is usually installed when it's not in PATH
+std::vector<std::string> well_known_locations(const std::string& program){
+  std::vector<std::string> res{};
+  const std::string home = get_env("HOME");
+#if defined USE_WINAPI
+  const std::string name = str::tolower(program);
+  if (name == "msbuild"){
+    for (auto& vs : {"C:\\Program Files\\Microsoft Visual Studio\\2022", "C:\\Program Files (x86)\\Microsoft Visual Studio\\2019", "D:\\bin\\Microsoft Visual Studio"}){
+      for (auto& edition : {"Community", "Professional", "Enterprise", "BuildTools"}){
+	res.push_back(FMT("{}\\{}\\MSBuild\\Current\\Bin\\MSBuild.exe", vs, edition));
+      }
+    }
+  } else if (name == "premake5"){
+    res = {"C:\\Program Files\\premake5\\premake5.exe", "D:\\bin\\premake 5.0 beta2\\premake5.exe"};
+  }
+  if (!home.empty()) res.push_back((fs::path(home) / "bin" / FMT("{}.exe", program)).string());
+#else
+  for (auto& dir : {"/usr/local/bin", "/usr/bin", "/opt/homebrew/bin", "/opt/local/bin"}) res.push_back(FMT("{}/{}", dir, program));
+  if (!home.empty()){
+    res.push_back((fs::path(home) / ".local" / "bin" / program).string());
+    res.push_back((fs::path(home) / "bin" / program).string());
+  }
+#endif
+  return res;
+}
+
+struct CompilerInfo {
+  uint64_t size{0};
+  int64_t mtime{0};
+  std::string version{};
+  std::vector<std::string> include_dirs{};
+  std::vector<std::string> macros{}; // `NAME value`, like after `#define`
+  std::vector<std::string> linkers{}; // the fast linkers the driver can use (`-fuse-ld=`), best first
+  uint64_t linkers_stamp{0};          // of the linker binaries when they were probed, see ToolCache::linkers_stamp()
+};
+
+struct ToolCache {
+  std::string filename{};
+  std::unordered_map<std::string, std::string> topdir{};
+  std::unordered_map<std::string, std::string> resolved{};   // "<program>|<PATH hash>" -> path
+  std::unordered_map<std::string, CompilerInfo> compilers{}; // "<path>|<language>"
+  bool dirty{false};
+
+  // size and mtime of `path`, false if it's not there
+  static bool stat(const std::string& path, uint64_t& size, int64_t& mtime){
+    std::error_code ec;
+    size = fs::file_size(path, ec);
+    if (ec) return false;
+    mtime = fs::last_write_time(path, ec).time_since_epoch().count();
+    return !ec;
+  }
+
+  // which fast linkers PATH has and their size and mtime, so installing or
+  // updating one probes the linkers again even though the compiler stayed the same
+  static uint64_t linkers_stamp(){
+    std::string found{};
+    for (auto ld : {"ld.mold", "mold", "ld.lld", "lld"}){
+      const std::string path = os::find_program(ld);
+      uint64_t size{0};
+      int64_t mtime{0};
+      if (!path.empty() && stat(path, size, mtime)) found += FMT("{} {} {}\n", path, size, mtime);
+    }
+    return hash::fnv1a64(found);
+  }
+
+  // format: the header line, then `r <key>\t<path>` for every lookup and
+  // `c <key>\t<size> <mtime>` for every compiler followed by its `v <version>`,
+  // `i <include dir>`, `m <macro>`, `l <linker>` and `k <linkers stamp>` lines
+  void load(){
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs.is_open()) return;
+    std::string line{};
+    if (!std::getline(ifs, line) || line != TOOLCHAIN_CACHE_HEADER) return;
+    CompilerInfo* cur{nullptr};
+    while (std::getline(ifs, line)){
+      if (line.size() < 2) continue;
+      const std::string rest = line.substr(2);
+      const size_t tab = rest.find('\t');
+      switch (line[0]){
+      case 'r':
+	if (tab != std::string::npos) resolved[rest.substr(0, tab)] = rest.substr(tab + 1);
+	break;
+      case 'c':
+	cur = nullptr;
+	if (tab != std::string::npos){
+	  cur = &compilers[rest.substr(0, tab)];
+	  if (sscanf(rest.c_str() + tab + 1, "%llu %lld", (unsigned long long*)&cur->size, (long long*)&cur->mtime) != 2) cur->size = 0;
+	}
+	break;
+      case 'v': if (cur) cur->version = rest; break;
+      case 'i': if (cur) cur->include_dirs.push_back(rest); break;
+      case 'm': if (cur) cur->macros.push_back(rest); break;
+      case 'l': if (cur) cur->linkers.push_back(rest); break;
+      case 'k': if (cur) cur->linkers_stamp = std::strtoull(rest.c_str(), nullptr, 16); break;
+      }
+    }
+  }
+
+  bool save(){
+    if (!dirty) return true;
+    std::string out{TOOLCHAIN_CACHE_HEADER "\n"};
+    for (auto& [key, path] : resolved) out += FMT("r {}\t{}\n", key, path);
+    for (auto& [key, info] : compilers){
+      out += FMT("c {}\t{} {}\nv {}\n", key, info.size, info.mtime, info.version);
+      for (auto& i : info.include_dirs) out += FMT("i {}\n", i);
+      for (auto& m : info.macros) out += FMT("m {}\n", m);
+      for (auto& l : info.linkers) out += FMT("l {}\n", l);
+      out += FMT("k {:x}\n", info.linkers_stamp);
+    }
+    std::error_code ec;
+    fs::create_directories(fs::path(filename).parent_path(), ec);
+    std::string tmp = filename + ".tmp";
+    {
+      std::ofstream ofs(tmp, std::ios::binary);
+      if (!ofs.is_open()) return false;
+      ofs.write(out.data(), out.size());
+    }
+    fs::rename(tmp, filename, ec);
+    dirty = ec.value() != 0;
+    return !dirty;
+  }
+
+  // `program` looked up in PATH, then in the well known locations; empty if it's nowhere
+  std::string resolve(const std::string& program){
+    const std::string key = FMT("{}|{}", program, hash::to_hex(hash::fnv1a64(get_env("PATH"))));
+    std::error_code ec;
+    auto it = resolved.find(key);
+    if (it != resolved.end() && fs::is_regular_file(it->second, ec)) return it->second;
+    std::string path = os::find_program(program);
+    if (path.empty() && !fs::path(program).has_parent_path()){
+      for (auto& p : well_known_locations(program)){
+	if (fs::is_regular_file(p, ec)){
+	  path = p;
+	  break;
+	}
+      }
+    }
+    if (path.empty()) return path;
+    path = fs::absolute(path, ec).string();
+    resolved[key] = path;
+    dirty = true;
+    return path;
+  }
+
+  // the `<key>_path` from the .topdir if it's set, else `program`; resolved,
+  // or left as is if it can't be found so running it fails with the usual error
+  std::string tool(const std::string& key, const std::string& program){
+    auto it = topdir.find(FMT("{}_path", key));
+    if (it != topdir.end() && !it->second.empty()){
+      std::error_code ec;
+      if (fs::is_regular_file(it->second, ec)) return it->second;
+      fprint(std::cerr, "WARNING: {}_path `{}` in {} doesn't exist, looking for {} instead\n", key, it->second, ROOT_IDENTIFIER, program);
+    }
+    std::string path = resolve(program);
+    return path.empty() ? program : path;
+  }
+
+  const CompilerInfo& probe(const std::string& path, bool msvc, bool c){
+    const std::string key = FMT("{}|{}", path, c ? "c" : "c++");
+    uint64_t size{0};
+    int64_t mtime{0};
+    stat(path, size, mtime);
+    auto it = compilers.find(key);
+    if (it != compilers.end() && it->second.size == size && it->second.mtime == mtime){
+      if (!msvc){
+	const uint64_t stamp = linkers_stamp();
+	if (it->second.linkers_stamp != stamp){
+	  probe_linkers(path, it->second);
+	  it->second.linkers_stamp = stamp;
+	  dirty = true;
+	}
+      }
+      return it->second;
+    }
+
+    TraceSpan span("momobuild", FMT("probe {}", key));
+    CompilerInfo info{size, mtime};
+    std::string output{};
+    auto lines = [&](){ return str::split_by(output, '\n', true); };
+    if (msvc){
+      // the banner is the first thing cl.exe prints
+      proc::run_capture(path, {"/?"}, output);
+      for (auto& l : lines()){
+	if (l.find("Version") != std::string::npos){
+	  info.version = str::trim(l);
+	  break;
+	}
+      }
+      for (auto& d : str::split_by(get_env("INCLUDE"), ';', true)){
+	if (!str::trim(d).empty()) info.include_dirs.push_back(str::trim(d));
+      }
+    } else {
+      const char* lang = c ? "c" : "c++";
+      if (proc::run_capture(path, {"--version"}, output) == 0 && !lines().empty()) info.version = str::trim(lines()[0]);
+      output.clear();
+      proc::run_capture(path, {"-E", "-v", "-x", lang, NULL_DEVICE}, output);
+      bool in_list{false};
+      for (auto& l : lines()){
+	std::string line = str::trim(l);
+	if (line.starts_with("#include <...> search starts here")) in_list = true;
+	else if (line.starts_with("End of search list")) in_list = false;
+	else if (in_list && !line.empty()) info.include_dirs.push_back(str::replace(line, " (framework directory)", ""));
+      }
+      output.clear();
+      proc::run_capture(path, {"-dM", "-E", "-x", lang, NULL_DEVICE}, output);
+      for (auto& l : lines()){
+	std::string line = str::trim(l);
+	if (line.starts_with("#define ")) info.macros.push_back(line.substr(8));
+      }
+      std::sort(info.macros.begin(), info.macros.end());
+      info.linkers_stamp = linkers_stamp();
+      probe_linkers(path, info);
+    }
+    dirty = true;
+    return compilers[key] = std::move(info);
+  }
+
+  void probe_linkers(const std::string& path, CompilerInfo& info){
+    TraceSpan span("momobuild", FMT("probe linkers of {}", path));
+    info.linkers.clear();
+    // the driver only gets as far as asking the linker for its version if it found it
+    for (auto ld : {"mold", "lld"}){
+      std::string output{};
+      if (proc::run_capture(path, {FMT("-fuse-ld={}", ld), "-Wl,--version"}, output) == 0) info.linkers.push_back(ld);
+    }
+  }
+
+  // also runs on exit()
+  ~ToolCache(){
+    if (!filename.empty() && !save()) fprint(std::cerr, "WARNING: Could not write {}\n", filename);
+  }
+};
+
+// the directory with vc_redist.x64.exe: `configured` if it's set, else the newest
+// one in the Visual Studio install `msbuild` belongs to; empty if there is none
+fs::path find_vcredist(const std::string& configured, const fs::path& msbuild){
+  std::error_code ec;
+  if (!configured.empty()) return configured;
+  // <vs>/MSBuild/Current/Bin/MSBuild.exe -> <vs>/VC/Redist/MSVC/<version>/
+  fs::path redist = msbuild.parent_path().parent_path().parent_path().parent_path() / "VC" / "Redist" / "MSVC";
+  fs::path res{};
+  for (auto it = fs::directory_iterator(redist, ec); !ec && it != fs::directory_iterator(); it.increment(ec)){
+    if (fs::exists(it->path() / FMT("{}x64.exe", VCREDIST_EXE), ec) && it->path().filename() > res.filename()) res = it->path();
+  }
+  return res;
+}
+
+// loaded the first time it's needed, which is always after changing to the root dir
+ToolCache& tool_cache(){
+  static ToolCache cache{};
+  if (cache.filename.empty()){
+    cache.filename = fs::absolute(TOOLCHAIN_CACHE_PATH).string();
+    cache.topdir = parse_topdir();
+    cache.load();
+  }
+  return cache;
+}
+
+// toolchain --------------------------------------------------
+
+struct Toolchain {
+  std::string cc{};
+  std::string cxx{};
+  std::string ar{};
+  std::string ld{}; // only used by msvc, gcc/clang link through the driver
+  bool msvc{false};
+};
+
+// CC/CXX win over the .topdir's cc_path/cxx_path, which win over the platform's default
+Toolchain detect_toolchain(){
+  Toolchain tc{};
+  ToolCache& cache = tool_cache();
+  auto pick = [&](const char* env, const std::string& key, const std::string& fallback){
+    std::string p = get_env(env);
+    if (p.empty()) return cache.tool(key, fallback);
+    std::string path = cache.resolve(p);
+    return path.empty() ? p : path;
+  };
+#if defined USE_WINAPI
+  tc.cc = pick("CC", "cc", "cl");
+  tc.cxx = pick("CXX", "cxx", "cl");
+  tc.msvc = str::tolower(fs::path(tc.cxx).stem().string()) == "cl";
+  tc.ar = cache.tool("ar", tc.msvc ? "lib" : "ar");
+  tc.ld = cache.tool("ld", "link");
+#else
+  tc.cc = pick("CC", "cc", "cc");
+  tc.cxx = pick("CXX", "cxx", "c++");
+  tc.ar = cache.tool("ar", "ar");
+#endif
+  return tc;
+}
+
+// what links `config`: `linker.<config>` or `linker` from the .topdir, else
+// mold or lld if the compiler can use them. For gcc/clang it's the name passed
+// to -fuse-ld (empty for the compiler's default), for msvc the linker's path.
+std::string pick_linker(const Toolchain& tc, const std::string& config){
+  ToolCache& cache = tool_cache();
+  std::string linker{};
+  bool configured{false};
+  for (auto& key : {FMT("linker.{}", config), std::string{"linker"}}){
+    auto it = cache.topdir.find(key);
+    if (it == cache.topdir.end()) continue;
+    linker = it->second;
+    configured = true;
+    break;
+  }
+  if (linker == "default") return tc.msvc ? tc.ld : std::string{};
+  if (tc.msvc){
+    if (configured) return linker == "lld" ? cache.tool("lld-link", "lld-link") : cache.tool("link", linker);
+    const std::string lld = cache.resolve("lld-link");
+    return lld.empty() ? tc.ld : lld;
+  }
+  if (configured) return linker;
+  const CompilerInfo& info = cache.probe(tc.cxx, false, false);
+  return info.linkers.empty() ? std::string{} : info.linkers[0];
+}
+
+static std::vector<std::string> c_suffixes = {".c"};
+static std::vector<std::string> cpp_suffixes = {".cpp", ".cc", ".cxx", ".c++"};
+
+bool is_c_source(const std::string& f){
+  return std::any_of(c_suffixes.begin(), c_suffixes.end(), [&](const std::string& s){ return f.ends_with(s); });
+}
+
+bool is_compilable(const std::string& f){
+  return is_c_source(f) || std::any_of(cpp_suffixes.begin(), cpp_suffixes.end(), [&](const std::string& s){ return f.ends_with(s); });
+}
+
+std::string dialect_flag(const Toolchain& tc, std::string dialect){
+  dialect = str::tolower(dialect);
+  if (dialect.empty() || dialect == "default") return {};
+  if (tc.msvc){
+    if (dialect.ends_with("latest")) return "/std:c++latest";
+    return FMT("/std:{}", dialect);
+  }
+  if (dialect == "c++latest") return "-std=c++2b";
+  if (dialect == "clatest") return "-std=c2x";
+  return FMT("-std={}", dialect);
+}
+
+std::vector<std::string> compile_args(const Toolchain& tc, const ProjectConfig& cfg, const std::string& src, const std::string& obj){
+  std::vector<std::string> args{};
+  const bool c = is_c_source(src);
+  const std::string optimize = str::tolower(cfg.optimize);
+  if (tc.msvc){
+    args = {"/nologo", "/c", src, FMT("/Fo{}", obj), "/showIncludes"};
+    if (!c) args.push_back("/EHsc");
+    std::string std = dialect_flag(tc, c ? cfg.cdialect : cfg.cppdialect);
+    if (!std.empty()) args.push_back(std);
+    if (str::tolower(cfg.symbols) == "on") args.push_back("/Z7");
+    if (optimize == "on" || optimize == "speed" || optimize == "full") args.push_back("/O2");
+    else if (optimize == "size") args.push_back("/O1");
+    const bool debug_rt = str::tolower(cfg.config) == "debug";
+    const bool static_rt = str::tolower(cfg.staticruntime) == "on";
+    args.push_back(static_rt ? (debug_rt ? "/MTd" : "/MT") : (debug_rt ? "/MDd" : "/MD"));
+    for (auto& d : cfg.defines) args.push_back(FMT("/D{}", d));
+    for (auto& i : cfg.includedirs) args.push_back(FMT("/I{}", i));
+  } else {
+    args = {"-c", src, "-o", obj, "-MMD", "-MF", FMT("{}.d", obj)};
+    std::string std = dialect_flag(tc, c ? cfg.cdialect : cfg.cppdialect);
+    if (!std.empty()) args.push_back(std);
+    if (str::tolower(cfg.symbols) == "on") args.push_back("-g");
+    if (optimize == "on" || optimize == "speed") args.push_back("-O2");
+    else if (optimize == "full") args.push_back("-O3");
+    else if (optimize == "size") args.push_back("-Os");
+    else if (optimize == "debug") args.push_back("-Og");
+    if (cfg.kind == "SharedLib") args.push_back("-fPIC");
+    for (auto& d : cfg.defines) args.push_back(FMT("-D{}", d));
+    for (auto& i : cfg.includedirs) args.push_back(FMT("-I{}", i));
+  }
+  args.insert(args.end(), cfg.buildoptions.begin(), cfg.buildoptions.end());
+  return args;
+}
+
+// the file a project produces, relative to the root dir
+std::string target_path(const Toolchain& tc, const ProjectConfig& cfg){
+  fs::path dir{cfg.targetdir};
+  if (cfg.kind == "StaticLib") return (dir / (tc.msvc ? FMT("{}.lib", cfg.targetname) : FMT("lib{}.a", cfg.targetname))).generic_string();
+#if defined USE_WINAPI
+  if (cfg.kind == "SharedLib") return (dir / FMT("{}.dll", cfg.targetname)).generic_string();
+#else
+  if (cfg.kind == "SharedLib") return (dir / FMT("lib{}.so", cfg.targetname)).generic_string();
+#endif
+  return (dir / FMT("{}{}", cfg.targetname, EXE_SUFFIX)).generic_string();
+}
+
+struct LinkCmd {
+  std::string program{};
+  std::vector<std::string> args{};
+};
+
+// `libs` maps the names of workspace projects to the files they produce, `linker` comes from pick_linker()
+LinkCmd link_cmd(const Toolchain& tc, const ProjectConfig& cfg, const std::vector<std::string>& objs,
+		 const std::string& output, const std::vector<std::pair<std::string, std::string>>& libs, const std::string& linker={}){
+  LinkCmd cmd{};
+  auto workspace_lib = [&](const std::string& name) -> const std::string* {
+    for (auto& l : libs) if (l.first == name) return &l.second;
+    return nullptr;
+  };
+  const bool c_only = std::all_of(cfg.files.begin(), cfg.files.end(), [](const std::string& f){ return !is_compilable(f) || is_c_source(f); });
+  if (cfg.kind == "StaticLib"){
+    cmd.program = tc.ar;
+    cmd.args = tc.msvc ? std::vector<std::string>{"/nologo", FMT("/OUT:{}", output)} : std::vector<std::string>{"rcs", output};
+    cmd.args.insert(cmd.args.end(), objs.begin(), objs.end());
+    return cmd;
+  }
+  if (tc.msvc){
+    cmd.program = linker.empty() ? tc.ld : linker;
+    cmd.args = {"/nologo", FMT("/OUT:{}", output)};
+    if (cfg.kind == "SharedLib") cmd.args.push_back("/DLL");
+    if (str::tolower(cfg.symbols) == "on") cmd.args.push_back("/DEBUG");
+    cmd.args.insert(cmd.args.end(), objs.begin(), objs.end());
+    for (auto& d : cfg.libdirs) cmd.args.push_back(FMT("/LIBPATH:{}", d));
+    for (auto& l : cfg.links){
+      const std::string* lib = workspace_lib(l);
+      cmd.args.push_back(lib ? *lib : (l.ends_with(".lib") ? l : FMT("{}.lib", l)));
+    }
+  } else {
+    cmd.program = c_only ? tc.cc : tc.cxx;
+    cmd.args = {"-o", output};
+    if (!linker.empty()) cmd.args.push_back(FMT("-fuse-ld={}", linker));
+    if (cfg.kind == "SharedLib") cmd.args.push_back("-shared");
+    cmd.args.insert(cmd.args.end(), objs.begin(), objs.end());
+    for (auto& d : cfg.libdirs) cmd.args.push_back(FMT("-L{}", d));
+    for (auto& l : cfg.links){
+      const std::string* lib = workspace_lib(l);
+      cmd.args.push_back(lib ? *lib : FMT("-l{}", l));
+    }
+  }
+  cmd.args.insert(cmd.args.end(), cfg.linkoptions.begin(), cfg.linkoptions.end());
+  return cmd;
+}
+
+// metadata --------------------------------------------------
+// What momobuild measures or fingerprints and wants to remember across builds,
+// keyed `<what> <path>`: `duration <obj>`, `peak_memory <output>`, `test_duration <exe>`,
+// `premake_fingerprint`.
+#define METADATA_PATH "build/momobuild.meta"
+
+// opened the first time it's needed, which is always after changing to the root dir
+file::Store& metadata(){
+  static file::Store store{fs::absolute(METADATA_PATH).string()};
+  return store;
+}
+
+// 0 if `key` isn't there
+uint64_t metadata_number(const std::string& key){
+  auto value = metadata().get(key);
+  uint64_t n{0};
+  if (value) std::from_chars(value.unwrap().data(), value.unwrap().data() + value.unwrap().size(), n);
+  return n;
+}
+
+// dependencies --------------------------------------------------
+// Every object remembers the command that built it and every header it
+// included (from the compiler's -MMD depfile or /showIncludes). Paths are
+// interned so a header shared by thousands of objects is stored and stat'ed once.
+
+// parses a make style depfile (`obj.o: src.cpp a.hpp \`), returns the prerequisites
+std::vector<std::string> parse_depfile(std::string_view text){
+  std::vector<std::string> res{};
+  std::string cur{};
+  bool in_prereqs{false};
+  auto flush = [&](){
+    if (!cur.empty() && in_prereqs) res.push_back(cur);
+    cur.clear();
+  };
+  for (size_t i = 0; i < text.size(); ++i){
+    // copy the run of plain characters up to the next one that needs a look
+    const size_t special = sv::find_first_of(text, "\\$: \t\r\n\v\f", i);
+    cur.append(text, i, (special == std::string::npos ? text.size() : special) - i);
+    if (special == std::string::npos) break;
+    i = special;
+    const char c = text[i];
+    if (c == '\\' && i + 1 < text.size()){
+      const char n = text[i+1];
+      if (n == '\n' || n == '\r'){ // line continuation
+	flush();
+	++i;
+	if (n == '\r' && i + 1 < text.size() && text[i+1] == '\n') ++i;
+	continue;
+      }
+      if (n == ' ' || n == '#' || n == '\\'){ // escaped character
+	cur += n;
+	++i;
+	continue;
+      }
+      cur += c;
+    } else if (c == '$' && i + 1 < text.size() && text[i+1] == '$'){
+      cur += '$';
+      ++i;
+    } else if (c == ':' && !in_prereqs && (i + 1 >= text.size() || ch::isspace(text[i+1]))){
+      // `c:` in `c:\path` is a drive letter, not the end of the target
+      cur.clear();
+      in_prereqs = true;
+    } else if (c == '\n'){
+      flush();
+      // a new rule starts on the next line (-MP adds one for each header)
+      in_prereqs = false;
+    } else if (ch::isspace(c)){
+      flush();
+    } else {
+      cur += c;
+    }
+  }
+  flush();
+  return res;
+}
+
+#define SHOW_INCLUDES_PREFIX "Note: including file:"
+
+// pulls the headers out of cl.exe's /showIncludes output, the rest of the output is left in `output`
+std::vector<std::string> parse_show_includes(std::string& output){
+  std::vector<std::string> res{};
+  std::string rest{};
+  size_t start{0};
+  while (start < output.size()){
+    size_t end = output.find('\n', start);
+    if (end == std::string::npos) end = output.size();
+    const std::string_view line = std::string_view(output).substr(start, end - start);
+    if (line.starts_with(SHOW_INCLUDES_PREFIX)){
+      res.push_back(str::trim(line.substr(sizeof(SHOW_INCLUDES_PREFIX) - 1)));
+    } else {
+      rest += line;
+      rest += '\n';
+    }
+    start = end + 1;
+  }
+  output = rest;
+  return res;
+}
+
+uint64_t command_hash(const std::string& program, const std::vector<std::string>& args){
+  uint64_t h = hash::fnv1a64(program);
+  for (auto& a : args){
+    h = hash::fnv1a64(std::string_view("\0", 1), h);
+    h = hash::fnv1a64(a, h);
+  }
+  return h;
+}
+
+#define DEPS_DB_HEADER "momobuild-deps 1"
+
+struct DepsDb {
+  struct Record {
+    uint64_t cmd_hash{0};
+    std::vector<uint32_t> deps{};
+  };
+
+  std::vector<std::string> paths{};
+  std::unordered_map<std::string, uint32_t> path_ids{};
+  std::unordered_map<uint32_t, Record> records{}; // keyed by the object's path id
+  std::unordered_map<uint32_t, fs::file_time_type> mtimes{}; // stat cache, see forget()
+  std::unordered_set<uint32_t> isolated{};            // sources that broke a /unity batch
+  std::mutex mtx{};
+  bool dirty{false};
+
+  uint32_t intern(const std::string& path){
+    auto it = path_ids.find(path);
+    if (it != path_ids.end()) return it->second;
+    uint32_t id = uint32_t(paths.size());
+    paths.push_back(path);
+    path_ids.emplace(path, id);
+    return id;
+  }
+
+  // file_time_type::min() if the file doesn't exist
+  fs::file_time_type mtime(uint32_t id){
+    auto it = mtimes.find(id);
+    if (it != mtimes.end()) return it->second;
+    std::error_code ec;
+    auto t = fs::last_write_time(paths[id], ec);
+    if (ec) t = fs::file_time_type::min();
+    mtimes.emplace(id, t);
+    return t;
+  }
+
+  // drops `path` from the stat cache; a resident build (`watch`) keeps the
+  // cache between builds and calls this for every file that changed
+  void forget(const std::string& path){
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = path_ids.find(path);
+    if (it != path_ids.end()) mtimes.erase(it->second);
+  }
+
+  // format: the header line, then `p <path>` for every interned path (ids are implicit),
+  // `o <object id> <command hash> <dep id>...` for every object and `u <source id>` for
+  // every isolated source (the `t` and `m` lines of older databases are skipped, those
+  // measurements are in the metadata store now)
+  void load(const std::string& filename){
+    // mapped, the database of a big tree is megabytes
+    const file::MappedFile f(filename);
+    const sv::Split lines = sv::split(f.view(), "\n", true);
+    auto it = lines.begin();
+    if (it == lines.end() || *it != DEPS_DB_HEADER) return;
+    // the next space separated number in `v`
+    auto number = [](std::string_view& v, auto& n, int base=10){
+      sv::ltrim(v);
+      auto [end, ec] = std::from_chars(v.data(), v.data() + v.size(), n, base);
+      if (ec != std::errc{}) return false;
+      v.remove_prefix(size_t(end - v.data()));
+      return true;
+    };
+    for (++it; it != lines.end(); ++it){
+      const std::string_view line = *it;
+      if (line.size() < 2) continue;
+      std::string_view rest = line.substr(2);
+      if (line[0] == 'p'){
+	intern(std::string(rest));
+      } else if (line[0] == 'o'){
+	uint32_t obj{0};
+	Record r{};
+	if (!number(rest, obj) || !number(rest, r.cmd_hash, 16)) continue;
+	uint32_t dep{0};
+	while (number(rest, dep)){
+	  if (dep < paths.size()) r.deps.push_back(dep);
+	}
+	if (obj < paths.size()) records[obj] = std::move(r);
+      } else if (line[0] == 'u'){
+	uint32_t src{0};
+	if (number(rest, src) && src < paths.size()) isolated.insert(src);
+      }
+    }
+  }
+
+  bool save(const std::string& filename){
+    if (!dirty) return true;
+    std::string out{DEPS_DB_HEADER "\n"};
+    for (auto& p : paths){
+      out += "p ";
+      out += p;
+      out += '\n';
+    }
+    for (auto& [obj, r] : records){
+      out += FMT("o {} {:x}", obj, r.cmd_hash);
+      for (auto& d : r.deps) out += FMT(" {}", d);
+      out += '\n';
+    }
+    for (auto& src : isolated) out += FMT("u {}\n", src);
+    std::string tmp = filename + ".tmp";
+    {
+      std::ofstream ofs(tmp, std::ios::binary);
+      if (!ofs.is_open()) return false;
+      ofs.write(out.data(), out.size());
+    }
+    std::error_code ec;
+    fs::rename(tmp, filename, ec);
+    dirty = ec.value() != 0;
+    return !dirty;
+  }
+
+  // is `obj` newer than `src` and every header it used last time, and built with the same command?
+  bool up_to_date(const std::string& obj, const std::string& src, uint64_t cmd_hash){
+    auto it = path_ids.find(obj);
+    if (it == path_ids.end()) return false;
+    auto rec = records.find(it->second);
+    if (rec == records.end() || rec->second.cmd_hash != cmd_hash) return false;
+    auto obj_time = mtime(it->second);
+    if (obj_time == fs::file_time_type::min()) return false;
+    if (mtime(intern(src)) > obj_time) return false;
+    for (auto& d : rec->second.deps){
+      auto t = mtime(d);
+      if (t == fs::file_time_type::min() || t > obj_time) return false;
+    }
+    return true;
+  }
+
+  // was `output` last made by the command hashing to `cmd_hash`? (links only have a command, no deps)
+  bool same_command(const std::string& output, uint64_t cmd_hash){
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = path_ids.find(output);
+    if (it == path_ids.end()) return false;
+    auto rec = records.find(it->second);
+    return rec != records.end() && rec->second.cmd_hash == cmd_hash;
+  }
+
+  // thread safe, like everything below; measurements go to the metadata store
+  // so recording one is an append instead of a rewrite of the database
+  void record_duration(const std::string& obj, uint32_t ms){
+    metadata().set(FMT("duration {}", obj), std::to_string(ms));
+  }
+
+  // how long `obj` took to compile last time, 0 if it never was
+  uint32_t duration(const std::string& obj){
+    return uint32_t(metadata_number(FMT("duration {}", obj)));
+  }
+
+  void record_peak_memory(const std::string& output, uint64_t bytes){
+    metadata().set(FMT("peak_memory {}", output), std::to_string(bytes));
+  }
+
+  // 0 if `output` was never linked
+  uint64_t peak_memory(const std::string& output){
+    return metadata_number(FMT("peak_memory {}", output));
+  }
+
+  void isolate(const std::string& src){
+    std::lock_guard<std::mutex> lock(mtx);
+    if (isolated.insert(intern(src)).second) dirty = true;
+  }
+
+  bool is_isolated(const std::string& src){
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = path_ids.find(src);
+    return it != path_ids.end() && isolated.contains(it->second);
+  }
+
+  // called by the compile jobs
+  void record(const std::string& obj, uint64_t cmd_hash, const std::vector<std::string>& deps){
+    std::lock_guard<std::mutex> lock(mtx);
+    Record r{cmd_hash, {}};
+    r.deps.reserve(deps.size());
+    for (auto& d : deps) r.deps.push_back(intern(fs::path(d).lexically_normal().generic_string()));
+    uint32_t id = intern(obj);
+    records[id] = std::move(r);
+    mtimes.erase(id);
+    dirty = true;
+  }
+};
+
+// remote cache --------------------------------------------------
+// The object cache can be backed by a shared one, so what one machine (a CI
+// runner, a teammate's) compiled is a hit on the others. It's plain HTTP/1.1
+// over TCP or a unix socket: `GET <prefix>/<key>` answers 200 with the entry
+// or 404, `PUT <prefix>/<key>` stores one. Entries are stored as the local
+// cache keeps them, already compressed. `momobuild cache-server` is such a
+// server; anything that serves and accepts files under a path will do.
+//
+// A build never waits on it for long. The lookups of every job are written
+// together and pipelined on one connection. Uploads go out on another one in
+// the background. The first error or timeout turns it off for the rest of
+// the build. MOMOBUILD_REMOTE_CACHE, else `remote_cache:` in the .topdir, is
+// `http://host:port/prefix`, `host:port` or `unix:<path>`.
+
+#define REMOTE_CACHE_PORT "3738"
+#define REMOTE_CACHE_BATCH 256                        // requests written at once
+#define REMOTE_CACHE_TIMEOUT_MS 2000                  // a send or receive taking longer turns it off
+#define REMOTE_CACHE_FLUSH_MS 3000                    // what the uploads left at the end of a build get
+#define REMOTE_CACHE_MAX_QUEUED (uint64_t(256) << 20) // uploads beyond that many bytes are dropped
+#define HTTP_MAX_BODY (size_t(1) << 30)
+
+// buffered reads off a socket, for HTTP's lines and bodies
+struct SocketReader {
+  net::Socket s{INVALID_SOCK};
+  std::string buf{};
+  size_t pos{0};
+
+  bool fill(){
+    if (pos == buf.size()){
+      buf.clear();
+      pos = 0;
+    } else if (pos > (1 << 16)){
+      buf.erase(0, pos);
+      pos = 0;
+    }
+    const size_t old = buf.size();
+    buf.resize(old + (1 << 16));
+    const long n = net::recv_some(s, buf.data() + old, 1 << 16);
+    buf.resize(old + size_t(std::max<long>(n, 0)));
+    return n > 0;
+  }
+
+  // up to the next "\r\n" or "\n", which isn't kept
+  bool line(std::string& out){
+    for (;;){
+      const size_t eol = buf.find('\n', pos);
+      if (eol != std::string::npos){
+	out.assign(buf, pos, eol - pos);
+	if (!out.empty() && out.back() == '\r') out.pop_back();
+	pos = eol + 1;
+	return true;
+      }
+      if (buf.size() - pos > 8192 || !fill()) return false;
+    }
+  }
+
+  bool bytes(size_t n, std::string& out){
+    while (buf.size() - pos < n){
+      if (!fill()) return false;
+    }
+    out.assign(buf, pos, n);
+    pos += n;
+    return true;
+  }
+};
+
+struct HttpMessage {
+  std::string start{}; // the request or status line
+  std::string body{};
+  bool close{false};   // `Connection: close`
+};
+
+// a request or a reply with a Content-Length, chunked bodies aren't supported
+bool read_http(SocketReader& r, HttpMessage& m){
+  m = HttpMessage{};
+  if (!r.line(m.start)) return false;
+  size_t length{0};
+  std::string line{};
+  while (r.line(line)){
+    if (line.empty()) return length <= HTTP_MAX_BODY && r.bytes(length, m.body);
+    const size_t colon = line.find(':');
+    if (colon == std::string::npos) continue;
+    const std::string name = str::tolower(str::trim(line.substr(0, colon)));
+    const std::string value = str::tolower(str::trim(line.substr(colon + 1)));
+    if (name == "content-length") length = size_t(std::strtoull(value.c_str(), nullptr, 10));
+    else if (name == "connection") m.close = value == "close";
+    else if (name == "transfer-encoding" && value != "identity") return false;
+  }
+  return false;
+}
+
+// 200 out of `HTTP/1.1 200 OK`
+int http_status(const std::string& start){
+  const size_t space = start.find(' ');
+  return space == std::string::npos ? 0 : int(std::strtol(start.c_str() + space + 1, nullptr, 10));
+}
+
+struct RemoteCache {
+  std::string address{}; // for net::connect()
+  std::string host{};    // for the Host header
+  std::string prefix{};  // of every path, without a trailing '/'
+  std::atomic<bool> broken{false};
+  std::atomic<size_t> uploaded{0};
+
+  struct Lookup {
+    std::string key{};
+    bool done{false};
+    bool found{false};
+    std::string entry{};
+  };
+  std::mutex mtx{};
+  std::condition_variable cv{};
+  std::deque<Lookup*> lookups{};
+  std::deque<std::pair<std::string, std::string>> uploads{};
+  uint64_t queued{0}; // bytes
+  bool stopping{false};
+  std::chrono::steady_clock::time_point deadline{}; // for the uploads, once stopping
+  std::thread getter{};
+  std::thread putter{};
+
+  // MOMOBUILD_REMOTE_CACHE or the .topdir's `remote_cache`; nullptr if there's none or it doesn't parse
+  static std::unique_ptr<RemoteCache> configured(){
+    std::string url = get_env("MOMOBUILD_REMOTE_CACHE");
+    if (url.empty()) url = tool_cache().topdir["remote_cache"];
+    url = str::trim(url);
+    if (url.empty()) return nullptr;
+    auto res = std::make_unique<RemoteCache>();
+    if (url.starts_with("unix:")){
+      res->address = url;
+      res->host = "localhost";
+    } else {
+      if (url.starts_with("https://")){
+	fprint(std::cerr, "WARNING: The remote cache can't be reached over https, building without {}\n", url);
+	return nullptr;
+      }
+      if (url.starts_with("http://")) url = url.substr(sizeof("http://") - 1);
+      const size_t slash = url.find('/');
+      res->host = url.substr(0, slash);
+      if (slash != std::string::npos) res->prefix = url.substr(slash);
+      while (res->prefix.ends_with("/")) res->prefix.pop_back();
+      res->address = res->host.find(':') == std::string::npos ? FMT("{}:{}", res->host, REMOTE_CACHE_PORT) : res->host;
+    }
+    res->getter = std::thread([r = res.get()](){ r->get_loop(); });
+    res->putter = std::thread([r = res.get()](){ r->put_loop(); });
+    return res;
+  }
+
+  ~RemoteCache(){ finish(); }
+
+  // lets the uploads still queued go out for up to REMOTE_CACHE_FLUSH_MS
+  void finish(){
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (stopping) return;
+      stopping = true;
+      deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(REMOTE_CACHE_FLUSH_MS);
+    }
+    cv.notify_all();
+    if (getter.joinable()) getter.join();
+    if (putter.joinable()) putter.join();
+  }
+
+  void fail(const std::string& why){
+    if (!broken.exchange(true)) fprint(std::cerr, "WARNING: The remote cache {} {}, building without it\n", address, why);
+  }
+
+  net::Socket open(){
+    net::Socket s = net::connect(address, REMOTE_CACHE_TIMEOUT_MS);
+    if (s == INVALID_SOCK) fail("doesn't answer");
+    else net::set_timeout(s, REMOTE_CACHE_TIMEOUT_MS);
+    return s;
+  }
+
+  std::string request(const char* method, const std::string& key, size_t length){
+    return FMT("{} {}/{} HTTP/1.1\r\nHost: {}\r\nContent-Length: {}\r\n\r\n", method, prefix, key, host, length);
+  }
+
+  // waits for the batch `key` goes out with; false if it's not there or the remote cache is off
+  bool get(const std::string& key, std::string& entry){
+    if (broken) return false;
+    Lookup l{key};
+    std::unique_lock<std::mutex> lock(mtx);
+    lookups.push_back(&l);
+    cv.notify_all();
+    cv.wait(lock, [&](){ return l.done; });
+    if (l.found) entry = std::move(l.entry);
+    return l.found;
+  }
+
+  void put(const std::string& key, std::string entry){
+    if (broken) return;
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      if (stopping || queued + entry.size() > REMOTE_CACHE_MAX_QUEUED) return;
+      queued += entry.size();
+      uploads.emplace_back(key, std::move(entry));
+    }
+    cv.notify_all();
+  }
+
+  void get_loop(){
+    net::Socket s{INVALID_SOCK};
+    SocketReader r{};
+    std::vector<Lookup*> batch{};
+    for (;;){
+      {
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [&](){ return stopping || !lookups.empty(); });
+	if (lookups.empty()) break;
+	while (!lookups.empty() && batch.size() < REMOTE_CACHE_BATCH){
+	  batch.push_back(lookups.front());
+	  lookups.pop_front();
+	}
+      }
+      if (!broken && s == INVALID_SOCK){
+	s = open();
+	r = SocketReader{s};
+      }
+      std::string out{};
+      for (auto* l : batch) out += request("GET", l->key, 0);
+      bool ok = !broken && net::send_all(s, out);
+      if (!broken && !ok) fail("stopped answering");
+      bool closed{false}; // the rest of the batch is a miss, the next one gets a new connection
+      for (auto* l : batch){
+	HttpMessage m{};
+	if (ok && !closed && !read_http(r, m)){
+	  ok = false;
+	  fail("stopped answering");
+	}
+	const bool found = ok && !closed && http_status(m.start) == 200;
+	closed = closed || m.close;
+	std::lock_guard<std::mutex> lock(mtx);
+	l->found = found;
+	if (found) l->entry = std::move(m.body);
+	l->done = true;
+      }
+      cv.notify_all();
+      batch.clear();
+      if ((!ok || closed) && s != INVALID_SOCK){
+	net::close(s);
+	s = INVALID_SOCK;
+      }
+    }
+    if (s != INVALID_SOCK) net::close(s);
+  }
+
+  void put_loop(){
+    net::Socket s{INVALID_SOCK};
+    SocketReader r{};
+    std::vector<std::pair<std::string, std::string>> batch{};
+    for (;;){
+      {
+	std::unique_lock<std::mutex> lock(mtx);
+	cv.wait(lock, [&](){ return stopping || !uploads.empty(); });
+	if (uploads.empty() || broken || (stopping && std::chrono::steady_clock::now() > deadline)) break;
+	while (!uploads.empty() && batch.size() < REMOTE_CACHE_BATCH){
+	  queued -= uploads.front().second.size();
+	  batch.push_back(std::move(uploads.front()));
+	  uploads.pop_front();
+	}
+      }
+      if (s == INVALID_SOCK){
+	s = open();
+	r = SocketReader{s};
+	if (s == INVALID_SOCK) break;
+      }
+      std::string out{};
+      for (auto& [key, entry] : batch){
+	out += request("PUT", key, entry.size());
+	out += entry;
+      }
+      bool ok = net::send_all(s, out);
+      bool closed{false};
+      for (size_t i = 0; ok && !closed && i < batch.size(); ++i){
+	HttpMessage m{};
+	ok = read_http(r, m);
+	if (ok && http_status(m.start) / 100 == 2) uploaded++;
+	closed = m.close;
+      }
+      batch.clear();
+      if (!ok){
+	fail("stopped answering");
+	break;
+      }
+      if (closed){
+	net::close(s);
+	s = INVALID_SOCK;
+      }
+    }
+    if (s != INVALID_SOCK) net::close(s);
+  }
+};
+
+// object cache --------------------------------------------------
+// Content addressed cache of compiled objects, shared by every project on the
+// machine. The key is the hash of the preprocessed source, the compiler binary
+// and the compile flags, so switching branches or configs back and forth hits
+// it. Entries are lz4 compressed and evicted least recently used first.
+
+#define OBJECT_CACHE_MAGIC "momoobj1"
+#define OBJECT_CACHE_DEFAULT_SIZE (uint64_t(5) << 30)
+
+// "500M", "5G", "1024" -> bytes, 0 if it doesn't parse
+uint64_t parse_size(std::string s){
+  s = str::trim(s);
+  if (s.empty()) return 0;
+  uint64_t mul{1};
+  switch (std::toupper((unsigned char)s.back())){
+  case 'K': mul = uint64_t(1) << 10; break;
+  case 'M': mul = uint64_t(1) << 20; break;
+  case 'G': mul = uint64_t(1) << 30; break;
+  case 'T': mul = uint64_t(1) << 40; break;
+  }
+  if (mul != 1) s.pop_back();
+  try {
+    return uint64_t(std::stod(s) * double(mul));
+  } catch (...) {
+    return 0;
+  }
+}
+
+struct ObjectCache {
+  fs::path dir{};
+  uint64_t max_size{OBJECT_CACHE_DEFAULT_SIZE};
+  std::atomic<size_t> hits{0};
+  std::atomic<size_t> misses{0};
+  std::atomic<size_t> stored{0};
+  std::unique_ptr<RemoteCache> remote{}; // see RemoteCache::configured()
+  std::atomic<size_t> remote_hits{0};
+
+  // MOMOBUILD_CACHE_DIR, else the user's cache directory
+  static fs::path default_dir(){
+    std::string dir = get_env("MOMOBUILD_CACHE_DIR");
+    if (!dir.empty()) return dir;
+#if defined USE_WINAPI
+    std::string base = get_env("LOCALAPPDATA");
+    if (!base.empty()) return fs::path(base) / "momobuild" / "cache";
+#else
+    std::string base = get_env("XDG_CACHE_HOME");
+    if (!base.empty()) return fs::path(base) / "momobuild";
+#endif
+    std::string home = get_env("HOME");
+    if (!home.empty()) return fs::path(home) / ".cache" / "momobuild";
+    return {};
+  }
+
+  ObjectCache(){
+    dir = default_dir();
+    uint64_t size = parse_size(get_env("MOMOBUILD_CACHE_SIZE"));
+    if (size) max_size = size;
+  }
+
+  bool enabled() const { return !dir.empty() || remote; }
+
+  fs::path entry_path(const std::string& key) const {
+    return dir / key.substr(0, 2) / key;
+  }
+
+  // an entry is the magic, the object's size and the lz4 compressed object
+  static std::string pack(std::string_view object){
+    uint64_t size = object.size();
+    std::string out{OBJECT_CACHE_MAGIC};
+    out.append((const char*)&size, sizeof(size));
+    out += lz4::compress(object);
+    return out;
+  }
+
+  static bool unpack(std::string_view entry, const std::string& obj){
+    const size_t header = sizeof(OBJECT_CACHE_MAGIC) - 1 + sizeof(uint64_t);
+    if (entry.size() < header || entry.compare(0, sizeof(OBJECT_CACHE_MAGIC) - 1, OBJECT_CACHE_MAGIC) != 0) return false;
+    uint64_t size{0};
+    memcpy(&size, entry.data() + sizeof(OBJECT_CACHE_MAGIC) - 1, sizeof(size));
+    std::string out{};
+    if (!lz4::decompress(entry.substr(header), size_t(size), out)) return false;
+    std::ofstream ofs(obj, std::ios::binary);
+    if (!ofs.is_open()) return false;
+    ofs.write(out.data(), out.size());
+    return ofs.good();
+  }
+
+  bool write_entry(const std::string& key, const std::string& entry){
+    fs::path p = entry_path(key);
+    std::error_code ec;
+    fs::create_directories(p.parent_path(), ec);
+    // write then rename so a concurrent build never sees half an entry; other
+    // builds and a cache server share the dir, so the temp name has the pid in it
+    static std::atomic<uint64_t> writes{0};
+    fs::path tmp = p;
+    tmp += FMT(".{}.{}.tmp", os::pid(), writes++);
+    {
+      std::ofstream ofs(tmp, std::ios::binary);
+      if (!ofs.is_open()) return false;
+      ofs.write(entry.data(), entry.size());
+    }
+    fs::rename(tmp, p, ec);
+    if (ec) fs::remove(tmp, ec);
+    return !ec;
+  }
+
+  // writes the cached object for `key` to `obj`, from the remote cache if
+  // it's not on this machine (and keeps it here from then on)
+  bool fetch(const std::string& key, const std::string& obj, bool* from_remote=nullptr){
+    std::error_code ec;
+    if (!dir.empty()){
+      fs::path p = entry_path(key);
+      if (fs::exists(p, ec) && unpack(file::MappedFile(p.string()).view(), obj)){
+	// bump it in the LRU order
+	fs::last_write_time(p, fs::file_time_type::clock::now(), ec);
+	return true;
+      }
+    }
+    std::string entry{};
+    if (!remote || !remote->get(key, entry) || !unpack(entry, obj)) return false;
+    if (!dir.empty() && write_entry(key, entry)) stored++;
+    remote_hits++;
+    if (from_remote) *from_remote = true;
+    return true;
+  }
+
+  void store(const std::string& key, const std::string& obj){
+    std::string entry = pack(file::MappedFile(obj).view());
+    if (!dir.empty() && write_entry(key, entry)) stored++;
+    if (remote) remote->put(key, std::move(entry));
+  }
+
+  struct Usage {
+    size_t entries{0};
+    uint64_t size{0};
+  };
+
+  // removes the least recently used entries until the cache fits in max_size, returns what's left
+  Usage evict(){
+    struct Entry {
+      fs::path path{};
+      uint64_t size{0};
+      fs::file_time_type time{};
+    };
+    std::vector<Entry> entries{};
+    Usage usage{};
+    std::error_code ec;
+    if (!fs::is_directory(dir, ec)) return usage;
+    for (auto it = fs::recursive_directory_iterator(dir, ec); it != fs::recursive_directory_iterator(); it.increment(ec)){
+      if (ec) break;
+      if (!it->is_regular_file(ec) || it->path().filename() == "stats") continue;
+      Entry e{it->path(), it->file_size(ec), it->last_write_time(ec)};
+      usage.size += e.size;
+      entries.push_back(std::move(e));
+    }
+    usage.entries = entries.size();
+    if (usage.size <= max_size) return usage;
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b){ return a.time < b.time; });
+    // leave some room so the next build doesn't evict again right away
+    const uint64_t target = max_size / 10 * 9;
+    for (auto& e : entries){
+      if (usage.size <= target) break;
+      if (fs::remove(e.path, ec)){
+	usage.size -= e.size;
+	usage.entries--;
+      }
+    }
+    return usage;
+  }
+
+  // adds this build's hits and misses to the totals in `dir/stats`
+  std::pair<size_t, size_t> update_stats(){
+    fs::path p = dir / "stats";
+    size_t total_hits{0}, total_misses{0};
+    std::ifstream ifs(p);
+    std::string key{};
+    size_t value{0};
+    while (ifs >> key >> value){
+      if (key == "hits") total_hits = value;
+      else if (key == "misses") total_misses = value;
+    }
+    ifs.close();
+    total_hits += hits;
+    total_misses += misses;
+    if (hits || misses){
+      std::error_code ec;
+      fs::create_directories(dir, ec);
+      std::ofstream ofs(p);
+      ofs << "hits " << total_hits << "\nmisses " << total_misses << "\n";
+    }
+    return {total_hits, total_misses};
+  }
+};
+
+// serves `dir` as a remote cache on `address` until it's killed, evicting down
+// to MOMOBUILD_CACHE_SIZE as it fills up
+int run_cache_server(const std::string& address, const fs::path& dir, bool quiet){
+  ObjectCache store{};
+  store.dir = dir;
+  net::Socket server = net::listen(address);
+  if (server == INVALID_SOCK) ERR("Could not listen on {}: {}\n", address, net::last_error());
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  auto usage = store.evict();
+  if (!quiet) print("{}: Cache server listening on {}, {} entries ({:.1f} MiB of {:.1f} MiB) in {}...\n", "momobuild", address,
+		    usage.entries, double(usage.size) / (1 << 20), double(store.max_size) / (1 << 20), dir.string());
+
+  std::mutex evict_mtx{};
+  std::atomic<uint64_t> stored_bytes{0}; // since the last eviction
+  // keys are hex, so a path can't point anywhere else
+  auto valid_key = [](const std::string& key){
+    return key.size() >= 16 && key.size() <= 64 && std::all_of(key.begin(), key.end(), [](char c){ return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'); });
+  };
+  auto reply = [](int status, const char* reason, std::string_view body, bool send_body=true){
+    std::string out = FMT("HTTP/1.1 {} {}\r\nContent-Length: {}\r\n\r\n", status, reason, body.size());
+    if (send_body) out += body;
+    return out;
+  };
+
+  for (;;){
+    net::Socket s = net::accept(server);
+    if (s == INVALID_SOCK) continue;
+    std::thread([&, s](){
+      SocketReader r{s};
+      HttpMessage m{};
+      while (read_http(r, m)){
+	// `GET /<prefix>/<key> HTTP/1.1`
+	const std::vector<std::string> parts = str::split_by(m.start, ' ');
+	const std::string method = parts.size() == 3 ? parts[0] : std::string{};
+	const std::string key = parts.size() == 3 ? parts[1].substr(parts[1].rfind('/') + 1) : std::string{};
+	std::string out{};
+	if (!valid_key(key)){
+	  out = reply(400, "Bad Request", {});
+	} else if (method == "GET" || method == "HEAD"){
+	  const fs::path p = store.entry_path(key);
+	  std::error_code ec;
+	  if (fs::exists(p, ec)){
+	    out = reply(200, "OK", file::MappedFile(p.string()).view(), method == "GET");
+	    fs::last_write_time(p, fs::file_time_type::clock::now(), ec);
+	  } else {
+	    out = reply(404, "Not Found", {});
+	  }
+	} else if (method == "PUT"){
+	  const bool ok = store.write_entry(key, m.body);
+	  out = ok ? reply(201, "Created", {}) : reply(500, "Internal Server Error", {});
+	  if (ok && (stored_bytes += m.body.size()) > store.max_size / 10){
+	    std::unique_lock<std::mutex> lock(evict_mtx, std::try_to_lock);
+	    if (lock.owns_lock()){
+	      stored_bytes = 0;
+	      store.evict();
+	    }
+	  }
+	} else {
+	  out = reply(405, "Method Not Allowed", {});
+	}
+	if (!net::send_all(s, out) || m.close) break;
+      }
+      net::close(s);
+    }).detach();
+  }
+  return 0;
+}
+
+// the compiler's version and predefined macros (what it targets, the language
+// it defaults to); the same on every machine with the same compiler, so the
+// remote cache is shared by them
+std::string compiler_identity(const Toolchain& tc, const std::string& program){
+  const CompilerInfo& info = tool_cache().probe(program, tc.msvc, program == tc.cc && program != tc.cxx);
+  std::string macros{};
+  for (auto& m : info.macros) macros += m + '\n';
+  return FMT("{}|{}", info.version, hash::to_hex(hash::xxh64(macros)));
+}
+
+// turns the compile command into one that only preprocesses `src` into `out`
+std::vector<std::string> preprocess_args(const Toolchain& tc, std::vector<std::string> args, const std::string& obj, const std::string& out){
+  for (auto& a : args){
+    if (tc.msvc){
+      if (a == "/c") a = "/P";
+      else if (a == FMT("/Fo{}", obj)) a = FMT("/Fi{}", out);
+    } else {
+      if (a == "-c") a = "-E";
+      else if (a == obj) a = out;
+    }
+  }
+  // a precompiled header can't be used while preprocessing, /FI includes the header itself
+  if (tc.msvc) std::erase_if(args, [](const std::string& a){ return a.starts_with("/Yu") || a.starts_with("/Fp"); });
+  return args;
+}
+
+// whether the compiler is told to spell `root` as `.` in what it writes
+// (__FILE__, debug info): -ffile-prefix-map=<root>=. or /pathmap:<root>=.
+bool maps_root(const std::vector<std::string>& args, const std::string& root){
+  for (auto& a : args){
+    for (std::string_view flag : {"-ffile-prefix-map=", "/pathmap:"}){
+      if (!a.starts_with(flag)) continue;
+      const size_t eq = a.rfind('=');
+      if (eq == std::string::npos || eq < flag.size()) continue;
+      std::string from = a.substr(flag.size(), eq - flag.size());
+      while (from.size() > 1 && (from.back() == '/' || from.back() == '\\')) from.pop_back();
+      if (fs::path(from).generic_string() == root) return true;
+    }
+  }
+  return false;
+}
+
+// 128 bit key out of everything that goes into the object. The object still
+// has the root dir in it (__FILE__, line markers, debug info) unless the
+// compiler maps it away, so only then is it left out of the key wherever it's
+// spelled out and checkouts in different places share entries.
+std::string cache_key(const std::string& identity, const std::vector<std::string>& args, const std::string& obj, const std::string& preprocessed){
+  const std::string cwd = fs::current_path().generic_string();
+  // an empty root is never searched for
+  const std::string root = maps_root(args, cwd) ? cwd : std::string{};
+  std::string flags = identity;
+  for (auto& a : args){
+    flags += '\0';
+    // the object's own path doesn't change what's in it
+    std::string arg = str::replace(a, obj, "<obj>");
+    flags += root.empty() ? arg : str::replace(arg, root, "<root>");
+  }
+  uint64_t seeds[2] = {hash::xxh64(flags), ~hash::xxh64(flags)};
+  std::string_view rest{preprocessed};
+  for (;;){
+    const size_t at = root.empty() ? std::string_view::npos : rest.find(root);
+    for (auto& seed : seeds) seed = hash::xxh64(rest.substr(0, at), seed);
+    if (at == std::string_view::npos) break;
+    rest.remove_prefix(at + root.size());
+  }
+  return hash::to_hex(seeds[0]) + hash::to_hex(seeds[1]);
+}
+
+// distributed compiles --------------------------------------------------
+// `momobuild worker` compiles for other machines. A build hands a compile to
+// the least busy worker once all of its own jobs are busy: the source is
+// preprocessed locally, so the worker only needs the same compiler (by
+// compiler_identity(), which covers what it targets), and the object comes
+// back in the reply. Whatever goes wrong on the way, a worker that's full,
+// gone, too slow to answer or has another compiler, the source is compiled
+// locally instead. Workers come from MOMOBUILD_WORKERS, else from
+// `workers:` in the .topdir, separated by commas or spaces.
+//
+// A message is `<n>\n` followed by `<size>\n<bytes>` for every one of its n
+// parts. The first part says what it is:
+//   status                                  -> ok <protocol> <running> <slots> <cc identity> <c++ identity>
+//   compile <lang> <identity> <args> <name> <source>
+//                                           -> done <exit code> <output> <object> <running> <slots>
+//                                           -> busy <running> <slots>
+//                                           -> refused <reason> <running> <slots>
+// `args` are '\n' separated, `lang` is `c` or `c++`. A connection carries as
+// many requests as the client wants, one after the other.
+
+#define WORKER_PORT "3737"
+#define WORKER_PROTOCOL "momobuild-worker 2"
+#define WORKER_STATUS_TIMEOUT_MS 5000
+// a compile that doesn't come back within this plus WORKER_TIMEOUT_FACTOR
+// times what it took last time counts as a lost worker
+#define WORKER_TIMEOUT_MS 30000
+#define WORKER_TIMEOUT_FACTOR 4
+#define WORKER_MAX_PARTS 16
+#define WORKER_MAX_PART_SIZE (size_t(1) << 30)
+
+bool send_message(net::Socket s, const std::vector<std::string>& parts){
+  std::string out = FMT("{}\n", parts.size());
+  for (auto& p : parts){
+    out += FMT("{}\n", p.size());
+    out += p;
+  }
+  return net::send_all(s, out);
+}
+
+bool recv_message(net::Socket s, std::vector<std::string>& parts){
+  auto count = [&](size_t& n){
+    std::string line{};
+    if (!net::recv_line(s, line) || line.empty()) return false;
+    char* end{nullptr};
+    n = size_t(std::strtoull(line.c_str(), &end, 10));
+    return *end == '\0';
+  };
+  parts.clear();
+  size_t n{0};
+  if (!count(n) || n > WORKER_MAX_PARTS) return false;
+  for (size_t i = 0; i < n; ++i){
+    size_t size{0};
+    if (!count(size) || size > WORKER_MAX_PART_SIZE) return false;
+    std::string& p = parts.emplace_back(size, '\0');
+    if (!net::recv_all(s, p.data(), size)) return false;
+  }
+  return true;
+}
+
+// `host`, `host:port`, `:port` or `unix:<path>`; the port defaults to WORKER_PORT
+std::string worker_address(const std::string& address){
+  if (address.starts_with("unix:")) return address;
+  const size_t colon = address.rfind(':');
+  const size_t bracket = address.rfind(']');
+  if (colon == std::string::npos || (bracket != std::string::npos && colon < bracket)) return FMT("{}:{}", address, WORKER_PORT);
+  return address;
+}
+
+// MOMOBUILD_WORKERS, else the .topdir's `workers`
+std::vector<std::string> configured_workers(){
+  std::string list = get_env("MOMOBUILD_WORKERS");
+  if (list.empty()) list = tool_cache().topdir["workers"];
+  std::vector<std::string> res{};
+  for (auto& a : str::split_by(str::replace(list, ",", " "), ' ')){
+    if (!str::trim(a).empty()) res.push_back(worker_address(str::trim(a)));
+  }
+  return res;
+}
+
+// the compile command minus what only matters to preprocessing or to this
+// machine: the source, the object, the depfile, include dirs and defines
+std::vector<std::string> remote_args(const Toolchain& tc, const std::vector<std::string>& args, const std::string& src){
+  std::vector<std::string> res{};
+  for (size_t i = 0; i < args.size(); ++i){
+    const std::string& a = args[i];
+    if (a == src) continue;
+    if (tc.msvc){
+      if (a == "/showIncludes") continue;
+      if (a.starts_with("/Fo") || a.starts_with("/D") || a.starts_with("/I") || a.starts_with("/Yu") || a.starts_with("/FI") || a.starts_with("/Fp")) continue;
+    } else {
+      if (a == "-o" || a == "-MF" || a == "-include" || a == "-isystem" || a == "-iquote"){
+	i++;
+	continue;
+      }
+      if (a == "-MMD" || a == "-MD" || a.starts_with("-I") || a.starts_with("-D")) continue;
+    }
+    res.push_back(a);
+  }
+  return res;
+}
+
+// what a worker passes on to its compiler, it refuses anything else: flags
+// that change how the (preprocessed) source is compiled and warned about, never
+// another input or anything that reads or writes files of its choosing or loads code
+bool allowed_remote_arg(bool msvc, const std::string& a){
+  auto in = [&](const std::vector<std::string>& list){ return std::find(list.begin(), list.end(), a) != list.end(); };
+  auto under = [&](const std::vector<std::string>& list){
+    return std::any_of(list.begin(), list.end(), [&](const std::string& p){ return a.starts_with(p); });
+  };
+  if (msvc){
+    static const std::vector<std::string> exact = {"/c", "/nologo", "/Z7", "/utf-8", "/bigobj", "/sdl", "/sdl-", "/J", "/openmp",
+						   "/permissive", "/permissive-"};
+    static const std::vector<std::string> prefixes = {"/std:", "/O", "/W", "/w", "/EH", "/MD", "/MT", "/GR", "/GS", "/Gy", "/Gw", "/GF",
+						      "/Gd", "/Gr", "/Gv", "/Gz", "/Zc:", "/Zp", "/arch:", "/fp:", "/favor:", "/source-charset:",
+						      "/execution-charset:", "/diagnostics:", "/guard:", "/volatile:", "/Qspectre", "/external:W",
+						      "/pathmap:"};
+    return in(exact) || under(prefixes);
+  }
+  static const std::vector<std::string> exact = {"-c", "-w", "-pthread", "-pedantic", "-pedantic-errors", "-ansi"};
+  static const std::vector<std::string> prefixes = {"-std=", "-O", "-g", "-W", "-m", "--param="};
+  // the members of the families above that hand args to other tools or touch files
+  static const std::vector<std::string> exceptions = {"-Wl,", "-Wa,", "-Wp,", "-gsplit-dwarf", "-mllvm"};
+  if (in(exact) || (under(prefixes) && !under(exceptions))) return true;
+  if (!a.starts_with("-f")) return false;
+  // -f is a family too wide to fence off, so only these (and their -fno- forms) are taken
+  static const std::vector<std::string> f_exact = {"-fPIC", "-fpic", "-fPIE", "-fpie", "-fexceptions", "-frtti", "-fasynchronous-unwind-tables",
+						   "-funwind-tables", "-fomit-frame-pointer", "-fstrict-aliasing", "-fstrict-overflow",
+						   "-fstrict-enums", "-fwrapv", "-ftrapv", "-fcommon", "-ffunction-sections", "-fdata-sections",
+						   "-fvisibility-inlines-hidden", "-fpermissive", "-fms-extensions", "-fms-compatibility",
+						   "-fdeclspec", "-fdelayed-template-parsing", "-fshort-enums", "-fshort-wchar", "-fsigned-char",
+						   "-funsigned-char", "-fchar8_t", "-fcoroutines", "-fconcepts", "-fsized-deallocation",
+						   "-faligned-new", "-fthreadsafe-statics", "-felide-constructors", "-fbuiltin", "-ffreestanding",
+						   "-fgnu89-inline", "-fopenmp", "-fstack-protector", "-fstack-protector-strong",
+						   "-fstack-protector-all", "-fstack-clash-protection", "-fcf-protection", "-fplt",
+						   "-fsemantic-interposition", "-fzero-initialized-in-bss", "-ffast-math", "-fmath-errno",
+						   "-ffinite-math-only", "-ftrapping-math", "-funsafe-math-optimizations",
+						   "-finline-functions", "-funroll-loops", "-fvectorize", "-fslp-vectorize", "-ftree-vectorize",
+						   "-flto", "-fjump-tables", "-fcolor-diagnostics", "-fdiagnostics-color",
+						   "-fdiagnostics-show-option", "-fshow-column", "-fcaret-diagnostics"};
+  // and these with a value, which is never a file
+  static const std::vector<std::string> f_valued = {"-fvisibility=", "-fcf-protection=", "-ffp-contract=", "-ffp-model=",
+						    "-fexcess-precision=", "-fdiagnostics-color=", "-fmessage-length=", "-fmax-errors=",
+						    "-ftemplate-depth=", "-fconstexpr-depth=", "-fconstexpr-steps=", "-fbracket-depth=",
+						    "-finline-limit=", "-flto=", "-fsanitize=", "-fno-sanitize=", "-fsanitize-recover=",
+						    "-fno-sanitize-recover=", "-fsanitize-trap=", "-fno-sanitize-trap=", "-ftls-model=",
+						    "-fopenmp=", "-fabi-version=", "-fms-compatibility-version=", "-ftrivial-auto-var-init=",
+						    "-fzero-call-used-regs=", "-ffile-prefix-map=", "-fdebug-prefix-map=", "-fmacro-prefix-map="};
+  if (std::any_of(f_valued.begin(), f_valued.end(), [&](const std::string& p){ return a.starts_with(p) && a.size() > p.size(); })) return true;
+  const std::string positive = a.starts_with("-fno-") ? "-f" + a.substr(5) : a;
+  return std::find(f_exact.begin(), f_exact.end(), positive) != f_exact.end();
+}
+
+// serves compiles on `address` until it's killed, at most `slots` at once
+int run_worker(const std::string& address, size_t slots, bool quiet){
+  // somewhere to keep the sources and objects, and the toolchain cache, that
+  // doesn't clash with other workers on the same machine
+  const fs::path dir = fs::temp_directory_path() / FMT("momobuild-worker-{}", hash::to_hex(hash::fnv1a64(address)));
+  std::error_code ec;
+  fs::create_directories(dir, ec);
+  fs::current_path(dir);
+  const Toolchain tc = detect_toolchain();
+  const std::string programs[2] = {tc.cc, tc.cxx};
+  const std::string versions[2] = {tool_cache().probe(tc.cc, tc.msvc, true).version, tool_cache().probe(tc.cxx, tc.msvc, false).version};
+  const std::string identities[2] = {compiler_identity(tc, tc.cc), compiler_identity(tc, tc.cxx)};
+  tool_cache().save();
+
+  net::Socket server = net::listen(address);
+  if (server == INVALID_SOCK) ERR("Could not listen on {}: {}\n", address, net::last_error());
+  if (!quiet){
+    print("{}: Worker listening on {} with {} slot(s)...\n", "momobuild", address, slots);
+    print("    cc:  {} ({})\n", tc.cc, versions[0]);
+    print("    cxx: {} ({})\n", tc.cxx, versions[1]);
+  }
+
+  std::atomic<size_t> running{0};
+  std::atomic<size_t> next_id{0};
+  auto compile = [&](const std::vector<std::string>& req) -> std::vector<std::string> {
+    auto load = [&](){ return std::vector<std::string>{std::to_string(size_t(running)), std::to_string(slots)}; };
+    auto refuse = [&](const std::string& reason){
+      std::vector<std::string> res{"refused", reason};
+      for (auto& l : load()) res.push_back(l);
+      return res;
+    };
+    if (req.size() != 6) return refuse("malformed request");
+    const std::string& lang = req[1];
+    const std::string& name = req[4];
+    if (lang != "c" && lang != "c++") return refuse(FMT("unknown language `{}`", lang));
+    const bool c = lang == "c";
+    if (req[2] != identities[c ? 0 : 1]) return refuse(FMT("its {} compiler is `{}`", lang, identities[c ? 0 : 1]));
+    std::vector<std::string> args = str::split_by(req[3], '\n');
+    for (auto& a : args){
+      if (!allowed_remote_arg(tc.msvc, a)) return refuse(FMT("`{}` isn't allowed", a));
+    }
+    if (running++ >= slots){
+      running--;
+      std::vector<std::string> res{"busy"};
+      for (auto& l : load()) res.push_back(l);
+      return res;
+    }
+
+    // a name the peer can't guess, so nothing it sends can point at the file it's written to
+    std::random_device rd{};
+    const std::string stem = FMT("{}-{:08x}{:08x}", next_id++, rd(), rd());
+    const std::string in = FMT("{}{}", stem, c ? ".i" : ".ii");
+    const std::string out = FMT("{}{}", stem, tc.msvc ? ".obj" : ".o");
+    std::string output{};
+    int ret{1};
+    {
+      std::ofstream ofs(in, std::ios::binary);
+      ofs.write(req[5].data(), req[5].size());
+    }
+    if (tc.msvc){
+      args.insert(args.end(), {FMT("{}{}", c ? "/Tc" : "/Tp", in), FMT("/Fo{}", out)});
+    } else {
+      args.insert(args.end(), {"-x", c ? "cpp-output" : "c++-cpp-output", in, "-o", out});
+    }
+    const auto begin = std::chrono::steady_clock::now();
+    ret = proc::run_capture(programs[c ? 0 : 1], args, output);
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+    // cl.exe always echoes the name of the file it's compiling
+    if (tc.msvc && str::trim(output) == in) output.clear();
+    std::string object = ret == 0 ? file::slurp_file(out) : std::string{};
+    std::error_code ec;
+    fs::remove(in, ec);
+    fs::remove(out, ec);
+    running--;
+    if (!quiet) print("{}: {} {} in {} ms\n", "momobuild", name, ret == 0 ? "compiled" : "FAILED", ms);
+    std::vector<std::string> res{"done", std::to_string(ret), std::move(output), std::move(object)};
+    for (auto& l : load()) res.push_back(l);
+    return res;
+  };
+
+  for (;;){
+    net::Socket s = net::accept(server);
+    if (s == INVALID_SOCK) continue;
+    std::thread([&, s](){
+      std::vector<std::string> req{};
+      while (recv_message(s, req) && !req.empty()){
+	std::vector<std::string> res{};
+	if (req[0] == "status") res = {"ok", WORKER_PROTOCOL, std::to_string(size_t(running)), std::to_string(slots), identities[0], identities[1]};
+	else if (req[0] == "compile") res = compile(req);
+	else res = {"refused", FMT("unknown request `{}`", req[0]), std::to_string(size_t(running)), std::to_string(slots)};
+	if (!send_message(s, res)) break;
+      }
+      net::close(s);
+    }).detach();
+  }
+  return 0;
+}
+
+struct RemoteResult {
+  int ret{0};
+  std::string output{};
+  std::string object{};
+  std::string worker{}; // its address
+};
+
+// hands compiles to the workers, the least busy one first
+struct Dispatcher {
+  struct Worker {
+    std::string address{};
+    size_t slots{0};
+    size_t running{0}; // what it said it was running the last time it answered, and what we've sent since
+    size_t ours{0};    // compiles of this build it has right now
+    bool down{false};  // didn't answer, this build leaves it alone
+    std::string identities[2]{}; // of its c and c++ compilers, see compiler_identity()
+    std::vector<net::Socket> idle{}; // connections for the next requests
+  };
+  std::vector<Worker> workers{};
+  std::mutex mtx{};
+
+  // asks every worker how busy it is at once; the ones that don't answer are left out
+  Dispatcher(const std::vector<std::string>& addresses){
+    workers.resize(addresses.size());
+    std::vector<std::thread> threads{};
+    for (size_t i = 0; i < addresses.size(); ++i){
+      threads.emplace_back([&, i](){
+	Worker& w = workers[i];
+	w.address = addresses[i];
+	w.down = true;
+	net::Socket s = net::connect(w.address);
+	std::vector<std::string> res{};
+	if (s == INVALID_SOCK) return;
+	net::set_timeout(s, WORKER_STATUS_TIMEOUT_MS);
+	if (!send_message(s, {"status"}) || !recv_message(s, res) || res.size() != 6 || res[0] != "ok" || res[1] != WORKER_PROTOCOL){
+	  net::close(s);
+	  return;
+	}
+	w.running = size_t(std::strtoull(res[2].c_str(), nullptr, 10));
+	w.slots = size_t(std::strtoull(res[3].c_str(), nullptr, 10));
+	w.identities[0] = res[4];
+	w.identities[1] = res[5];
+	w.idle.push_back(s);
+	w.down = false;
+      });
+    }
+    for (auto& t : threads) t.join();
+    for (auto& w : workers){
+      if (w.down) fprint(std::cerr, "WARNING: Worker {} doesn't answer, building without it\n", w.address);
+    }
+  }
+
+  ~Dispatcher(){
+    for (auto& w : workers) for (auto s : w.idle) net::close(s);
+  }
+
+  // what the workers that answered run at once
+  size_t slots() const {
+    size_t res{0};
+    for (auto& w : workers) if (!w.down) res += w.slots;
+    return res;
+  }
+
+  // false if no worker took it or it never came back, the caller compiles it itself then;
+  // `expected_ms` is what it took last time (0 if it never was), to tell a hung worker by
+  bool compile(const std::string& lang, const std::string& identity, const std::vector<std::string>& args,
+	       const std::string& name, const std::string& source, uint32_t expected_ms, RemoteResult& res){
+    const size_t v = lang == "c" ? 0 : 1;
+    Worker* w{nullptr};
+    net::Socket s{INVALID_SOCK};
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      double least{1};
+      for (auto& c : workers){
+	if (c.down || !c.slots || c.identities[v] != identity) continue;
+	const double load = double(std::max(c.running, c.ours)) / double(c.slots);
+	if (load < least){
+	  least = load;
+	  w = &c;
+	}
+      }
+      if (!w) return false;
+      w->running++;
+      w->ours++;
+      if (!w->idle.empty()){
+	s = w->idle.back();
+	w->idle.pop_back();
+      }
+    }
+    std::string joined{};
+    for (auto& a : args) joined += (joined.empty() ? "" : "\n") + a;
+    if (s == INVALID_SOCK) s = net::connect(w->address);
+    // a worker that hangs or a connection that's gone without a word would hold the build up forever
+    if (s != INVALID_SOCK) net::set_timeout(s, int(std::min<uint64_t>(INT32_MAX, WORKER_TIMEOUT_MS + uint64_t(expected_ms) * WORKER_TIMEOUT_FACTOR)));
+    std::vector<std::string> reply{};
+    const bool answered = s != INVALID_SOCK && send_message(s, {"compile", lang, identity, joined, name, source}) && recv_message(s, reply);
+
+    std::lock_guard<std::mutex> lock(mtx);
+    w->ours--;
+    if (!answered || reply.size() < 3){
+      if (s != INVALID_SOCK) net::close(s);
+      if (!w->down) fprint(std::cerr, "WARNING: Lost worker {}, building without it\n", w->address);
+      w->down = true;
+      return false;
+    }
+    w->idle.push_back(s);
+    w->running = size_t(std::strtoull(reply[reply.size() - 2].c_str(), nullptr, 10));
+    w->slots = size_t(std::strtoull(reply[reply.size() - 1].c_str(), nullptr, 10));
+    if (reply[0] == "refused"){
+      // it won't ever take what this build sends it
+      fprint(std::cerr, "WARNING: Worker {} refused {}: {}\n", w->address, name, reply[1]);
+      w->down = true;
+    }
+    if (reply[0] != "done" || reply.size() != 6) return false;
+    res.ret = int(std::strtol(reply[1].c_str(), nullptr, 10));
+    res.output = std::move(reply[2]);
+    res.object = std::move(reply[3]);
+    res.worker = w->address;
+    return true;
+  }
+};
+
+// precompiled headers --------------------------------------------------
+// Every C++ project gets a precompiled header made of the includes most of
+// its sources start with, as long as including them is expensive and they
+// don't belong to the project (system headers, or anything under lib/).
+// Only the #includes a source starts with count, before any other directive
+// or code, so forcing the header in first doesn't change what the source
+// means. A project header a source starts with is followed into: the system
+// headers it starts with are what the source really starts with. What each
+// file starts with is kept by mtime and what each include costs is measured
+// once with a syntax only compile, in `{objdir}/pch/state`.
+// The header is rebuilt like any object: when it or one of its headers changes.
+
+#define PCH_STATE_HEADER "momobuild-pch 1"
+#define PCH_MIN_SOURCES 4   // fewer sources than that aren't worth a precompiled header
+#define PCH_MIN_SHARE 0.5   // of the project's C++ sources that must start with an include
+#define PCH_MIN_COST_MS 20  // cpu time including a header has to add to a source
+
+// the `#include`s `src` starts with, spelled `<name>` or `"name"`
+std::vector<std::string> leading_includes(const std::string& src){
+  std::vector<std::string> res{};
+  size_t i{0};
+  while (i < src.size()){
+    if (ch::isspace(src[i])){
+      i++;
+    } else if (src.compare(i, 2, "//") == 0){
+      i = src.find('\n', i);
+    } else if (src.compare(i, 2, "/*") == 0){
+      i = src.find("*/", i + 2);
+      if (i != std::string::npos) i += 2;
+    } else if (src[i] == '#'){
+      size_t eol = src.find('\n', i);
+      if (eol == std::string::npos) eol = src.size();
+      std::string line = str::trim(src.substr(i + 1, eol - i - 1));
+      i = eol;
+      if (line == "pragma once") continue;
+      if (!line.starts_with("include")) break;
+      line = str::trim(line.substr(sizeof("include") - 1));
+      // `#include MACRO` can't be followed
+      const char close = line.starts_with("<") ? '>' : line.starts_with("\"") ? '"' : 0;
+      const size_t end = close ? line.find(close, 1) : std::string::npos;
+      if (end == std::string::npos) break;
+      res.push_back(line.substr(0, end + 1));
+    } else {
+      break;
+    }
+  }
+  return res;
+}
+
+// where an include of `src` leads: `"path"` for a file that was found (relative
+// to the root dir when it's inside it), `<name>` for the compiler's own headers
+std::string resolve_include(const ProjectConfig& cfg, const std::string& src, const std::string& inc){
+  const std::string name = inc.substr(1, inc.size() - 2);
+  std::vector<fs::path> dirs{};
+  if (inc[0] == '"') dirs.push_back(fs::path(src).parent_path());
+  for (auto& d : cfg.includedirs) dirs.push_back(d);
+  std::error_code ec;
+  for (auto& d : dirs){
+    fs::path p = (d / name).lexically_normal();
+    if (!fs::is_regular_file(p, ec)) continue;
+    if (p.is_absolute() || p.generic_string().starts_with("..")) p = fs::weakly_canonical(p, ec);
+    return FMT("\"{}\"", p.generic_string());
+  }
+  return FMT("<{}>", name);
+}
+
+// headers outside the tree and under lib/ (see `init`) don't change while working on the project
+bool is_stable_include(const std::string& key){
+  if (key[0] == '<') return true;
+  const std::string path = key.substr(1, key.size() - 2);
+  return fs::path(path).is_absolute() || path.starts_with("lib/");
+}
+
+struct PchState {
+  struct Source {
+    int64_t mtime{0};
+    std::vector<std::string> includes{}; // resolved, see resolve_include()
+  };
+
+  uint64_t flags{0}; // hash of the compile command the costs were measured with
+  std::unordered_map<std::string, Source> sources{};
+  std::unordered_map<std::string, double> costs{}; // ms, "" is the cost of an empty source
+  bool dirty{false};
+
+  // format: the header line, `f <flags>`, then `s <mtime> <source>\t<include>...` and `c <ms> <include>`
+  void load(const std::string& filename){
+    std::ifstream ifs(filename, std::ios::binary);
+    if (!ifs.is_open()) return;
+    std::string line{};
+    if (!std::getline(ifs, line) || line != PCH_STATE_HEADER) return;
+    while (std::getline(ifs, line)){
+      if (line.size() < 2) continue;
+      char* end{nullptr};
+      if (line[0] == 'f'){
+	flags = std::strtoull(line.c_str() + 2, &end, 16);
+      } else if (line[0] == 's'){
+	Source s{std::strtoll(line.c_str() + 2, &end, 10), {}};
+	std::vector<std::string> fields{};
+	size_t start = size_t(end - line.c_str()) + 1;
+	while (start <= line.size()){
+	  size_t tab = line.find('\t', start);
+	  if (tab == std::string::npos) tab = line.size();
+	  fields.push_back(line.substr(start, tab - start));
+	  start = tab + 1;
+	}
+	if (fields.empty()) continue;
+	s.includes.assign(fields.begin() + 1, fields.end());
+	sources[fields[0]] = std::move(s);
+      } else if (line[0] == 'c'){
+	double ms = std::strtod(line.c_str() + 2, &end);
+	costs[*end ? std::string(end + 1) : std::string{}] = ms;
+      }
+    }
+  }
+
+  bool save(const std::string& filename){
+    if (!dirty) return true;
+    std::string out = FMT("{}\nf {:x}\n", PCH_STATE_HEADER, flags);
+    for (auto& [src, s] : sources){
+      out += FMT("s {} {}", s.mtime, src);
+      for (auto& inc : s.includes) out += "\t" + inc;
+      out += '\n';
+    }
+    for (auto& [inc, ms] : costs) out += FMT("c {:.1f} {}\n", ms, inc);
+    std::ofstream ofs(filename, std::ios::binary);
+    if (!ofs.is_open()) return false;
+    ofs.write(out.data(), out.size());
+    dirty = false;
+    return true;
+  }
+};
+
+struct Pch {
+  std::string header{};   // the generated header, relative to the root dir
+  std::string output{};   // what the compiler makes of it
+  std::string obj{};      // msvc only, has to be linked into the target
+  std::string program{};
+  std::vector<std::string> args{};
+  uint64_t cmd_hash{0};
+  std::unordered_set<std::string> users{}; // the sources it's forced into
+
+  explicit operator bool() const { return !header.empty(); }
+};
+
+// the command that checks `src` without making anything
+std::vector<std::string> syntax_only_args(const Toolchain& tc, const std::vector<std::string>& args){
+  std::vector<std::string> res{};
+  for (size_t i = 0; i < args.size(); ++i){
+    const std::string& a = args[i];
+    if (tc.msvc){
+      if (a == "/c") res.push_back("/Zs");
+      else if (!a.starts_with("/Fo") && a != "/showIncludes") res.push_back(a);
+    } else {
+      if (a == "-c") res.push_back("-fsyntax-only");
+      else if (a == "-o" || a == "-MF") i++;
+      else if (a != "-MMD") res.push_back(a);
+    }
+  }
+  return res;
+}
+
+// forces `pch` into a source's compile command
+void use_pch(const Toolchain& tc, const Pch& pch, std::vector<std::string>& args){
+  const std::string header = fs::absolute(pch.header).generic_string();
+  if (tc.msvc){
+    args.insert(args.end(), {FMT("/Yu{}", header), FMT("/FI{}", header), FMT("/Fp{}", pch.output)});
+  } else {
+    // gcc and clang pick up `header`.gch on their own
+    args.insert(args.end(), {"-include", header});
+  }
+}
+
+// decides what goes into `cfg`'s precompiled header and writes it; returns an empty Pch if it isn't worth one
+Pch plan_pch(const Toolchain& tc, const ProjectConfig& cfg, DepsDb& deps, size_t jobs){
+  std::vector<std::string> sources{};
+  for (auto& f : cfg.files) if (is_compilable(f) && !is_c_source(f)) sources.push_back(f);
+  if (sources.size() < PCH_MIN_SOURCES) return {};
+
+  const fs::path dir = fs::path(cfg.objdir) / "pch";
+  fs::create_directories(dir);
+  const std::string state_path = (dir / "state").generic_string();
+  PchState state{};
+  state.load(state_path);
+  const uint64_t flags = command_hash(tc.cxx, compile_args(tc, cfg, {}, {}));
+  if (state.flags != flags){
+    state.costs.clear();
+    state.flags = flags;
+    state.dirty = true;
+  }
+
+  // what a source or one of the project's headers starts with
+  std::unordered_set<std::string> present{};
+  auto leading = [&](const std::string& path) -> const std::vector<std::string>& {
+    present.insert(path);
+    const int64_t mtime = int64_t(deps.mtime(deps.intern(path)).time_since_epoch().count());
+    PchState::Source& s = state.sources[path];
+    if (s.mtime != mtime || mtime == 0){
+      s.mtime = mtime;
+      s.includes.clear();
+      for (auto& inc : leading_includes(file::slurp_file(path))) s.includes.push_back(resolve_include(cfg, path, inc));
+      state.dirty = true;
+    }
+    return s.includes;
+  };
+  // the includes `path` starts with, what the project's headers among them start with in front of them
+  std::function<void(const std::string&, std::vector<std::string>&, std::unordered_set<std::string>&)> expand =
+    [&](const std::string& path, std::vector<std::string>& res, std::unordered_set<std::string>& seen){
+      const std::vector<std::string> incs = leading(path);
+      for (auto& inc : incs){
+	if (!seen.insert(inc).second) continue;
+	if (inc[0] == '"' && !is_stable_include(inc)) expand(inc.substr(1, inc.size() - 2), res, seen);
+	res.push_back(inc);
+      }
+    };
+  std::unordered_map<std::string, std::vector<std::string>> starts{};
+  // how many sources start with each include
+  std::unordered_map<std::string, size_t> counts{};
+  for (auto& src : sources){
+    std::unordered_set<std::string> seen{};
+    std::vector<std::string>& incs = starts[src];
+    expand(src, incs, seen);
+    for (auto& inc : incs) counts[inc]++;
+  }
+  std::erase_if(state.sources, [&](const auto& s){
+    if (present.contains(s.first)) return false;
+    state.dirty = true;
+    return true;
+  });
+  const size_t min_users = std::max<size_t>(PCH_MIN_SOURCES, size_t(double(sources.size()) * PCH_MIN_SHARE));
+
+  // measure whatever is common enough and hasn't been measured with these flags yet
+  std::vector<std::string> candidates{};
+  for (auto& [inc, n] : counts) if (n >= min_users && is_stable_include(inc)) candidates.push_back(inc);
+  std::vector<std::string> unmeasured{};
+  for (auto& inc : candidates) if (!state.costs.contains(inc)) unmeasured.push_back(inc);
+  if (!unmeasured.empty()){
+    if (!state.costs.contains("")) unmeasured.push_back("");
+    std::vector<double> ms(unmeasured.size(), 0);
+    Scheduler sched(std::min(jobs, unmeasured.size()));
+    for (size_t i = 0; i < unmeasured.size(); ++i){
+      sched.submit([&, i](){
+	const std::string probe = (dir / FMT("probe{}.cpp", i)).generic_string();
+	std::ofstream(probe) << (unmeasured[i].empty() ? std::string{} : FMT("#include {}\n", unmeasured[i]));
+	std::string output{};
+	int ret = proc::run_capture(tc.cxx, syntax_only_args(tc, compile_args(tc, cfg, probe, {})), output);
+	// an include that doesn't compile on its own never goes into the header
+	ms[i] = ret == 0 ? proc::last_usage().cpu_ms : -1;
+	std::error_code ec;
+	fs::remove(probe, ec);
+      });
+    }
+    sched.run();
+    for (size_t i = 0; i < unmeasured.size(); ++i) state.costs[unmeasured[i]] = ms[i];
+    state.dirty = true;
+  }
+  const double base = state.costs[""];
+
+  // greedily take the most expensive includes (times how many sources use
+  // them) while enough sources still start with every include taken
+  auto cost = [&](const std::string& inc){
+    const double ms = state.costs[inc];
+    return ms < 0 ? -1 : ms - base;
+  };
+  std::erase_if(candidates, [&](const std::string& inc){ return cost(inc) < PCH_MIN_COST_MS; });
+  std::sort(candidates.begin(), candidates.end(), [&](const std::string& a, const std::string& b){
+    return cost(a) * double(counts[a]) > cost(b) * double(counts[b]);
+  });
+  std::vector<std::string> taken{};
+  std::vector<std::string> users = sources;
+  for (auto& inc : candidates){
+    std::vector<std::string> rest{};
+    for (auto& src : users){
+      auto& incs = starts[src];
+      if (std::find(incs.begin(), incs.end(), inc) != incs.end()) rest.push_back(src);
+    }
+    if (rest.size() < min_users) continue;
+    taken.push_back(inc);
+    users = std::move(rest);
+  }
+  if (!state.save(state_path)) fprint(std::cerr, "WARNING: Could not write {}\n", state_path);
+  if (taken.empty()) return {};
+
+  // in the order the first user includes them
+  const auto& order = starts[users[0]];
+  std::sort(taken.begin(), taken.end(), [&](const std::string& a, const std::string& b){
+    return std::find(order.begin(), order.end(), a) < std::find(order.begin(), order.end(), b);
+  });
+  std::string text = FMT("// generated by momobuild from the includes most of {}'s sources start with\n#pragma once\n", cfg.name);
+  for (auto& inc : taken){
+    // the generated header lives elsewhere, paths are made absolute
+    const std::string spelled = inc[0] == '"' ? "\"" + fs::absolute(inc.substr(1, inc.size() - 2)).generic_string() + "\"" : inc;
+    text += FMT("#include {}\n", spelled);
+  }
+
+  Pch pch{};
+  pch.header = (dir / "pch.hpp").generic_string();
+  pch.users.insert(users.begin(), users.end());
+  // only written when it changes, every user depends on it
+  std::error_code ec;
+  if (!fs::exists(pch.header, ec) || file::slurp_file(pch.header) != text){
+    std::ofstream(pch.header, std::ios::binary) << text;
+  }
+  pch.program = tc.cxx;
+  if (tc.msvc){
+    const std::string src = (dir / "pch.cpp").generic_string();
+    const std::string header = fs::absolute(pch.header).generic_string();
+    if (!fs::exists(src, ec)) std::ofstream(src) << FMT("#include \"{}\"\n", header);
+    pch.output = (dir / "pch.pch").generic_string();
+    pch.obj = (dir / "pch.obj").generic_string();
+    pch.args = compile_args(tc, cfg, src, pch.obj);
+    pch.args.insert(pch.args.end(), {FMT("/Yc{}", header), FMT("/Fp{}", pch.output)});
+  } else {
+    pch.output = pch.header + ".gch";
+    pch.args = compile_args(tc, cfg, pch.header, pch.output);
+    // system headers count too, a precompiled one is stale once they change
+    for (auto& a : pch.args) if (a == "-MMD") a = "-MD";
+    pch.args.insert(pch.args.begin(), {"-x", "c++-header"});
+  }
+  pch.cmd_hash = command_hash(pch.program, pch.args);
+  return pch;
+}
+
+// unity --------------------------------------------------
+// `/unity` compiles each project's sources in batches; a batch is a generated
+// source including its members. Batches are packed by how long every member
+// took to compile on its own last time, about one batch's worth of work per
+// job, so they come out balanced rather than equally long. A batch that fails
+// is compiled member by member instead, and the members its errors point at
+// (clashing statics, leaking macros) are compiled on their own from then on.
+
+// splits `sources` (path, cost) into `n` batches of about the same cost; the most
+// expensive source goes into the cheapest batch first, ties keep the input order
+std::vector<std::vector<std::string>> pack_batches(std::vector<std::pair<std::string, double>> sources, size_t n){
+  std::stable_sort(sources.begin(), sources.end(), [](const auto& a, const auto& b){ return a.second > b.second; });
+  std::vector<std::vector<std::string>> batches(std::max<size_t>(1, std::min(n, sources.size())));
+  std::vector<double> load(batches.size(), 0);
+  for (auto& [src, cost] : sources){
+    size_t cheapest = size_t(std::min_element(load.begin(), load.end()) - load.begin());
+    batches[cheapest].push_back(src);
+    load[cheapest] += cost;
+  }
+  // members in path order, so the generated source only changes when the batch does
+  for (auto& b : batches) std::sort(b.begin(), b.end());
+  return batches;
+}
+
+// the members of a failed batch that `output` has errors about; they're
+// included by absolute path, compilers may print it either way
+std::vector<std::string> blame_sources(const std::string& output, const std::vector<std::string>& members){
+  std::vector<std::string> res{};
+  for (auto& m : members){
+    const fs::path abs = fs::absolute(m);
+    for (auto& spelled : {m, abs.generic_string(), abs.string()}){
+      // `file:line:col: error` (gcc/clang) or `file(line): error` (msvc)
+      if (output.find(spelled + ":") != std::string::npos || output.find(spelled + "(") != std::string::npos){
+	res.push_back(m);
+	break;
+      }
+    }
+  }
+  return res;
+}
+
+// writes the source of a batch (only if it changed, it's what the batch's object depends on)
+void write_unity_source(const std::string& path, const std::string& project, const std::vector<std::string>& members){
+  std::string text = FMT("// generated by momobuild, one /unity batch of {}\n", project);
+  for (auto& m : members){
+    const std::string abs = fs::absolute(m).generic_string();
+    text += FMT("#include \"{}\"\n", abs);
+  }
+  std::error_code ec;
+  if (fs::exists(path, ec) && file::slurp_file(path) == text) return;
+  fs::create_directories(fs::path(path).parent_path());
+  std::ofstream(path, std::ios::binary) << text;
+}
+
+// native build --------------------------------------------------
+
+struct BuildOptions {
+  size_t jobs{0}; // 0 = one per core
+  bool quiet{false};
+  bool use_cache{true};
+  bool live{false}; // pass compiler and linker output through as it comes instead of once the job is done
+  bool pch{true};   // precompile the headers most sources start with, see plan_pch()
+  bool unity{false}; // compile sources in batches, see pack_batches()
+  bool distribute{true}; // hand compiles to the configured workers, see Dispatcher
+};
+
+#define LINK_MEMORY_MIN (uint64_t(64) << 20)
+#define LINK_MEMORY_PER_INPUT_BYTE 2 // for a target that was never linked
+
+// how much memory the links running at once may take: MOMOBUILD_LINK_MEMORY
+// ("8G", "512M"), else half of the machine's
+uint64_t link_memory_budget(){
+  uint64_t budget = parse_size(get_env("MOMOBUILD_LINK_MEMORY"));
+  if (!budget) budget = os::physical_memory() / 2;
+  return std::max(budget, LINK_MEMORY_MIN);
+}
+
+bool out_of_date(const std::string& output, const std::vector<std::string>& inputs){
+  std::error_code ec;
+  auto out_time = fs::last_write_time(output, ec);
+  if (ec) return true;
+  for (auto& in : inputs){
+    auto in_time = fs::last_write_time(in, ec);
+    if (ec || in_time > out_time) return true;
+  }
+  return false;
+}
+
+// what one build learns about the tree: the toolchain, every project resolved
+// for every config and each config's dependency database with its stat cache.
+// A one-off build throws it away, `watch` keeps it warm between builds and
+// only forgets the parts a change touched.
+struct BuildState {
+  Toolchain tc{detect_toolchain()};
+  std::unordered_map<std::string, std::unique_ptr<DepsDb>> deps{};              // by config
+  std::unordered_map<std::string, std::vector<ProjectConfig>> projects{};       // by config, in workspace order
+
+  DepsDb& deps_for(const std::string& config){
+    auto& d = deps[config];
+    if (!d){
+      d = std::make_unique<DepsDb>();
+      d->load(deps_path(config));
+    }
+    return *d;
+  }
+
+  const std::vector<ProjectConfig>& projects_for(const Workspace& wks, const std::string& config){
+    auto it = projects.find(config);
+    if (it != projects.end()) return it->second;
+    std::vector<ProjectConfig> res{};
+    for (auto& prj : wks.projects) res.push_back(resolve_project(wks, prj, config));
+    return projects[config] = std::move(res);
+  }
+
+  // `paths` changed on disk
+  void forget(const std::vector<std::string>& paths){
+    for (auto& [config, d] : deps){
+      for (auto& p : paths) d->forget(p);
+    }
+  }
+
+  // files were added or removed, or premake5.lua changed: the globs have to be expanded again
+  void forget_projects(){ projects.clear(); }
+
+  static std::string deps_path(const std::string& config){ return FMT("build/{}.deps", config); }
+};
+
+// builds every project of every config as one graph on one scheduler, so all
+// configs share the job budget. Precompiled headers, compiles and links are
+// its nodes: a project's compiles wait for its precompiled header, its link
+// waits for its compiles and for the links of the workspace projects it links
+// against. Of the nodes that are ready, the one heading the longest chain (by
+// how long every step took last time) runs first, so whatever holds up the
+// end of the build starts as early as it can.
+int build_native(const Workspace& wks, const std::vector<std::string>& configs, const BuildOptions& opts, BuildState& state){
+  const Toolchain& tc = state.tc;
+  const size_t local_jobs = opts.jobs ? opts.jobs : std::max<size_t>(1, std::thread::hardware_concurrency());
+  // the deps and metadata go there even when the objdirs are somewhere else
+  std::error_code build_ec;
+  fs::create_directories("build", build_ec);
+  // the workers' slots are jobs on top of the local ones, a compile goes to
+  // them when local_jobs compiles are running here already
+  std::unique_ptr<Dispatcher> dist{};
+  std::string compiler_ids[2]{}; // of the c and c++ compiler, a worker needs the same
+  if (opts.distribute){
+    const std::vector<std::string> addresses = configured_workers();
+    if (!addresses.empty()) dist = std::make_unique<Dispatcher>(addresses);
+    if (dist && !dist->slots()) dist.reset();
+    if (dist){
+      compiler_ids[0] = compiler_identity(tc, tc.cc);
+      compiler_ids[1] = compiler_identity(tc, tc.cxx);
+    }
+  }
+  const size_t jobs = local_jobs + (dist ? dist->slots() : 0);
+  std::atomic<size_t> local_compiles{0};
+
+  struct Node;
+  struct Target {
+    ProjectConfig cfg{};
+    std::string output{};
+    std::vector<std::string> objs{};
+    Pch pch{};
+    Node* pch_node{nullptr};
+    Node* link_node{nullptr};
+  };
+  struct CompileJob;
+  // everything that belongs to one config; configs never share objects, deps or outputs
+  struct ConfigBuild {
+    std::string config{};
+    DepsDb* deps{nullptr};
+    std::vector<Target> targets{};
+    std::vector<CompileJob> unity{}; // /unity batches
+    std::string linker{};            // see pick_linker()
+    std::atomic<size_t> compiles{0};
+    std::atomic<size_t> done{0};
+    std::atomic<bool> failed{false};
+    std::mutex mtx{}; // for the targets' objs while compiling
+  };
+  struct CompileJob {
+    std::string program{};
+    std::vector<std::string> args{};
+    std::string src{};
+    std::string obj{};
+    uint64_t cmd_hash{0};
+    ConfigBuild* build{nullptr};
+    Target* target{nullptr};
+    bool pch{false};                    // gets the target's precompiled header
+    std::vector<std::string> members{}; // of a /unity batch
+    bool blamed{false};                 // isolate `src` from /unity batches once it compiles
+  };
+  enum class Step { pch, compile, link };
+  struct Node {
+    Step step{Step::compile};
+    ConfigBuild* build{nullptr};
+    Target* target{nullptr};
+    CompileJob* compile{nullptr};
+    std::vector<Node*> next{};      // nodes waiting for this one
+    std::atomic<size_t> waiting{0}; // nodes this one waits for
+    double cost{0};                 // ms
+    double priority{-1};            // ms of the longest chain from here to the end of the build
+  };
+
+  ObjectCache cache{};
+  if (!opts.use_cache) cache.dir.clear();
+  else cache.remote = RemoteCache::configured();
+  std::unordered_map<std::string, std::string> identities{};
+  if (cache.enabled()){
+    identities[tc.cc] = compiler_identity(tc, tc.cc);
+    identities[tc.cxx] = compiler_identity(tc, tc.cxx);
+  }
+
+  std::vector<std::unique_ptr<ConfigBuild>> builds{};
+  for (auto& config : configs){
+    builds.push_back(std::make_unique<ConfigBuild>());
+    ConfigBuild& b = *builds.back();
+    b.config = config;
+    b.deps = &state.deps_for(config);
+    b.linker = pick_linker(tc, config);
+    for (auto& cfg : state.projects_for(wks, config)){
+      Target t{cfg};
+      t.output = target_path(tc, t.cfg);
+      if (opts.pch) t.pch = plan_pch(tc, t.cfg, *b.deps, local_jobs);
+      b.targets.push_back(std::move(t));
+    }
+  }
+
+  // with several configs every line says which one it belongs to
+  auto tag = [&](const ConfigBuild& b){ return configs.size() > 1 ? FMT("[{}] ", b.config) : std::string{}; };
+  std::string config_list{"["};
+  for (auto& c : configs) config_list += (config_list.size() > 1 ? ", " : "") + c;
+  config_list += "]";
+  OutputMux& mux = output_mux();
+
+  // a link waits for the links of what it links against, which can't go round in a circle
+  for (auto& bp : builds){
+    std::unordered_map<std::string, const Target*> by_name{};
+    for (auto& t : bp->targets) by_name[t.cfg.name] = &t;
+    std::unordered_map<const Target*, int> visited{}; // 1 while its links are being visited, 2 after
+    std::vector<std::string> path{};
+    std::function<bool(const Target&)> acyclic = [&](const Target& t){
+      visited[&t] = 1;
+      path.push_back(t.cfg.name);
+      for (auto& name : t.cfg.links){
+	auto it = by_name.find(name);
+	if (it == by_name.end() || it->second == &t) continue;
+	if (visited[it->second] == 1){
+	  path.push_back(name);
+	  return false;
+	}
+	if (visited[it->second] == 0 && !acyclic(*it->second)) return false;
+      }
+      visited[&t] = 2;
+      path.pop_back();
+      return true;
+    };
+    for (auto& t : bp->targets){
+      if (visited[&t] != 0 || acyclic(t)) continue;
+      std::string cycle{};
+      for (auto it = std::find(path.begin(), path.end(), path.back()); it != path.end(); ++it) cycle += (cycle.empty() ? "" : " -> ") + *it;
+      fprint(std::cerr, "ERROR: {}Projects link each other in a circle: {}\n", tag(*bp), cycle);
+      return 1;
+    }
+  }
+
+  // a job compiling `src` of `t` on its own; a /unity batch of the precompiled header's users gets it too
+  auto single_job = [&](ConfigBuild& b, Target& t, const std::string& src, bool batch_of_users=false){
+    std::string obj = (fs::path(t.cfg.objdir) / FMT("{}{}", src, tc.msvc ? ".obj" : ".o")).lexically_normal().generic_string();
+    CompileJob c{is_c_source(src) ? tc.cc : tc.cxx, compile_args(tc, t.cfg, src, obj), src, obj};
+    c.pch = t.pch && (batch_of_users || t.pch.users.contains(src));
+    if (c.pch) use_pch(tc, t.pch, c.args);
+    c.cmd_hash = command_hash(c.program, c.args);
+    c.build = &b;
+    c.target = &t;
+    return c;
+  };
+
+  // /unity: the sources of every target are grouped by language and by whether
+  // they get the precompiled header, and every group is packed into batches
+  // worth about `budget` ms, i.e. about one batch per job for the whole build
+  struct UnityGroup {
+    ConfigBuild* build{nullptr};
+    Target* target{nullptr};
+    bool c{false};
+    bool pch{false};
+    std::vector<std::pair<std::string, double>> sources{};
+    double cost{0};
+  };
+  std::vector<UnityGroup> groups{};
+  if (opts.unity){
+    double known_ms{0};
+    size_t known{0};
+    for (auto& bp : builds){
+      for (auto& t : bp->targets){
+	for (auto& src : t.cfg.files){
+	  if (!is_compilable(src) || bp->deps->is_isolated(src)) continue;
+	  const bool c = is_c_source(src);
+	  const bool pch = t.pch && t.pch.users.contains(src);
+	  auto it = std::find_if(groups.begin(), groups.end(), [&](const UnityGroup& g){ return g.target == &t && g.c == c && g.pch == pch; });
+	  if (it == groups.end()){
+	    groups.push_back(UnityGroup{bp.get(), &t, c, pch});
+	    it = groups.end() - 1;
+	  }
+	  const uint32_t ms = bp->deps->duration(single_job(*bp, t, src).obj);
+	  if (ms){
+	    known_ms += ms;
+	    known++;
+	  }
+	  it->sources.push_back({src, double(ms)});
+	}
+      }
+    }
+    // what's never been timed costs as much as the average of what has
+    const double fallback = known ? known_ms / double(known) : 1;
+    double total{0};
+    for (auto& g : groups){
+      for (auto& s : g.sources){
+	if (s.second == 0) s.second = fallback;
+	g.cost += s.second;
+      }
+      total += g.cost;
+    }
+    const double budget = total / double(jobs);
+    std::erase_if(groups, [](const UnityGroup& g){ return g.sources.size() < 2; });
+    for (auto& g : groups){
+      const size_t n = std::max<size_t>(1, size_t(std::ceil(g.cost / budget - 0.01)));
+      Target& t = *g.target;
+      size_t i{0};
+      for (auto& members : pack_batches(g.sources, n)){
+	// a batch of one is just that source
+	if (members.size() < 2) continue;
+	const std::string base = (fs::path(t.cfg.objdir) / "unity" / FMT("{}{}{}", g.pch ? "pch_" : "", g.c ? "c" : "cpp", i++)).generic_string();
+	const std::string src = base + (g.c ? ".c" : ".cpp");
+	write_unity_source(src, t.cfg.name, members);
+	CompileJob c = single_job(*g.build, t, src, g.pch);
+	c.members = std::move(members);
+	g.build->unity.push_back(std::move(c));
+      }
+    }
+  }
+
+  // the graph; the compiles of failed /unity batches' members are added while it runs
+  std::deque<CompileJob> compiles{};
+  std::deque<Node> nodes{};
+  std::mutex graph_mtx{};
+  auto add_node = [&](Step step, ConfigBuild& b, Target& t, CompileJob* c) -> Node& {
+    std::lock_guard<std::mutex> lock(graph_mtx);
+    Node& n = nodes.emplace_back();
+    n.step = step;
+    n.build = &b;
+    n.target = &t;
+    n.compile = c;
+    return n;
+  };
+  auto edge = [](Node& from, Node& to){
+    from.next.push_back(&to);
+    to.waiting++;
+  };
+
+  size_t stale_pchs{0};
+  for (auto& bp : builds){
+    ConfigBuild& b = *bp;
+    for (auto& t : b.targets){
+      if (!t.pch) continue;
+      std::error_code ec;
+      const bool obj_missing = !t.pch.obj.empty() && !fs::exists(t.pch.obj, ec);
+      if (obj_missing || !b.deps->up_to_date(t.pch.output, t.pch.header, t.pch.cmd_hash)){
+	t.pch_node = &add_node(Step::pch, b, t, nullptr);
+	stale_pchs++;
+      }
+    }
+  }
+
+  for (auto& bp : builds){
+    ConfigBuild& b = *bp;
+    for (auto& t : b.targets){
+      if (!t.pch.obj.empty()) t.objs.push_back(t.pch.obj);
+      std::vector<CompileJob> jobs_of_target{};
+      // a source another project shares may be in one of its batches but not in this one's
+      std::unordered_set<std::string> batched{};
+      for (auto& c : b.unity){
+	if (c.target != &t) continue;
+	jobs_of_target.push_back(c);
+	batched.insert(c.members.begin(), c.members.end());
+      }
+      for (auto& src : t.cfg.files){
+	if (is_compilable(src) && !batched.contains(src)) jobs_of_target.push_back(single_job(b, t, src));
+      }
+      std::vector<Node*> compiled{};
+      for (auto& c : jobs_of_target){
+	t.objs.push_back(c.obj);
+	if (b.deps->up_to_date(c.obj, c.src, c.cmd_hash)) continue;
+	fs::create_directories(fs::path(c.obj).parent_path());
+	compiles.push_back(std::move(c));
+	b.compiles++;
+	Node& n = add_node(Step::compile, b, t, &compiles.back());
+	// a failing /unity batch compiles its members on their own, which needs to know who uses the pch
+	if ((compiles.back().pch || !compiles.back().members.empty()) && t.pch_node) edge(*t.pch_node, n);
+	compiled.push_back(&n);
+      }
+      if (t.objs.empty()) continue;
+      t.link_node = &add_node(Step::link, b, t, nullptr);
+      for (auto* n : compiled) edge(*n, *t.link_node);
+      if (t.pch_node) edge(*t.pch_node, *t.link_node);
+    }
+  }
+
+  // links wait for the links of what they link against; configs wait for
+  // each other when a targetdir without %{cfg.buildcfg} in it makes two of
+  // them write the same file
+  std::unordered_map<std::string, Node*> last_writer{};
+  for (auto& bp : builds){
+    for (auto& t : bp->targets){
+      if (!t.link_node) continue;
+      for (auto& name : t.cfg.links){
+	for (auto& dep : bp->targets){
+	  if (dep.cfg.name == name && dep.link_node && &dep != &t) edge(*dep.link_node, *t.link_node);
+	}
+      }
+      Node*& prev = last_writer[t.output];
+      if (prev) edge(*prev, *t.link_node);
+      prev = t.link_node;
+    }
+  }
+
+  // what every step is expected to take: what it took last time, else the
+  // average of the steps of its kind that were timed
+  auto last_time = [](Node& n){
+    DepsDb& deps = *n.build->deps;
+    switch (n.step){
+    case Step::pch: return deps.duration(n.target->pch.output);
+    case Step::compile: return deps.duration(n.compile->obj);
+    case Step::link: return deps.duration(n.target->output);
+    }
+    return uint32_t(0);
+  };
+  double sums[3]{};
+  size_t counts[3]{};
+  for (auto& n : nodes){
+    n.cost = last_time(n);
+    if (n.cost > 0){
+      sums[size_t(n.step)] += n.cost;
+      counts[size_t(n.step)]++;
+    }
+  }
+  const double compile_guess = counts[size_t(Step::compile)] ? sums[size_t(Step::compile)] / double(counts[size_t(Step::compile)]) : 1;
+  for (auto& n : nodes){
+    if (n.cost > 0) continue;
+    const size_t k = size_t(n.step);
+    n.cost = counts[k] ? sums[k] / double(counts[k]) : compile_guess;
+  }
+  std::function<double(Node&)> chain = [&](Node& n){
+    if (n.priority >= 0) return n.priority;
+    double longest{0};
+    for (auto* next : n.next) longest = std::max(longest, chain(*next));
+    return n.priority = n.cost + longest;
+  };
+  for (auto& n : nodes) chain(n);
+
+  if (!opts.quiet){
+    if (stale_pchs) print("\n{}: Precompiling {} header(s) {}...\n", "momobuild", stale_pchs, config_list);
+    if (compiles.empty()) print("\n{}: Nothing to compile {}...\n", "momobuild", config_list);
+    else {
+      const std::string remote = dist ? FMT(", {} of them on workers", dist->slots()) : std::string{};
+      print("\n{}: Compiling {} translation unit(s) {} with {} job(s){}...\n", "momobuild", compiles.size(), config_list, jobs, remote);
+    }
+  }
+
+  const uint64_t link_memory = link_memory_budget();
+  uint64_t memory_in_use{0};
+  std::vector<Node*> parked{}; // links that didn't fit in link_memory, they're retried when a link finishes
+  std::mutex memory_mtx{};
+  std::atomic<int> link_ret{0};
+  std::atomic<size_t> linked{0};
+  std::atomic<int64_t> link_ms{0};
+  const auto start = std::chrono::steady_clock::now();
+  std::atomic<int64_t> last_compile_ms{0}; // since start
+  auto since_start = [&](){ return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count(); };
+  auto compiled = [&](){
+    const int64_t now = since_start();
+    int64_t prev = last_compile_ms;
+    while (prev < now && !last_compile_ms.compare_exchange_weak(prev, now)) {}
+  };
+
+  mux.begin(stale_pchs + compiles.size());
+  Scheduler sched(jobs);
+  std::function<void(Node&)> ready{};
+  std::function<bool(Node&)> execute{};
+
+  auto precompile = [&](Node& node){
+    ConfigBuild& b = *node.build;
+    Target& t = *node.target;
+    Pch& pch = t.pch;
+    if (b.failed) return;
+    const std::string label = tag(b) + pch.header;
+    TraceSpan span("pch", label);
+    std::string output{};
+    const auto begin = std::chrono::steady_clock::now();
+    int ret = mux.run(label, pch.program, pch.args, output);
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+    span.set_proc(ret);
+    compiled();
+    std::vector<std::string> headers = tc.msvc ? parse_show_includes(output) : parse_depfile(file::MappedFile(FMT("{}.d", pch.output)).view());
+    std::error_code ec;
+    if (!tc.msvc) fs::remove(FMT("{}.d", pch.output), ec);
+    if (ret == 0){
+      b.deps->record(pch.output, pch.cmd_hash, headers);
+      b.deps->record_duration(pch.output, uint32_t(ms));
+      return;
+    }
+    // the project still builds, just without it; its compiles drop it when they see it's gone
+    b.deps->forget(pch.output);
+    mux.emit(FMT("WARNING: {}Precompiling the headers of {} failed, building without them:\n{}", tag(b), t.cfg.name, output));
+    {
+      std::lock_guard<std::mutex> lock(b.mtx);
+      if (!pch.obj.empty()) std::erase(t.objs, pch.obj);
+    }
+    pch = Pch{};
+  };
+
+  auto compile = [&](Node& node){
+    CompileJob& c = *node.compile;
+    ConfigBuild& b = *c.build;
+    if (b.failed) return;
+    if (c.pch && !c.target->pch){
+      std::vector<std::string> members = std::move(c.members);
+      c = single_job(b, *c.target, c.src);
+      c.members = std::move(members);
+    }
+    const std::string label = tag(b) + c.src;
+    TraceSpan span("compile", label);
+    int ret{0};
+    std::vector<std::string> headers{};
+    std::string output{};
+    std::string key{};
+    const std::string depfile = FMT("{}.d", c.obj);
+    std::error_code ec;
+
+    // for the cache key and for the workers; the headers come with it
+    std::string preprocessed{};
+    bool have_preprocessed{false};
+    auto preprocess = [&](){
+      const std::string pp_path = FMT("{}.i", c.obj);
+      std::string pp_output{};
+      const int pp_ret = proc::run_capture(c.program, preprocess_args(tc, c.args, c.obj, pp_path), pp_output);
+      span.set_proc(pp_ret);
+      if (pp_ret == 0){
+	preprocessed = file::slurp_file(pp_path);
+	headers = tc.msvc ? parse_show_includes(pp_output) : parse_depfile(file::MappedFile(depfile).view());
+	have_preprocessed = true;
+      }
+      fs::remove(pp_path, ec);
+      return have_preprocessed;
+    };
+
+    if (cache.enabled()){
+      if (preprocess()) key = cache_key(identities[c.program], c.args, c.obj, preprocessed);
+      bool from_remote{false};
+      if (!key.empty() && cache.fetch(key, c.obj, &from_remote)){
+	cache.hits++;
+	size_t n = ++b.done;
+	b.deps->record(c.obj, c.cmd_hash, headers);
+	compiled();
+	if (!opts.quiet) mux.emit(FMT("{}[{}/{}] {} (cached{})\n", tag(b), n, size_t(b.compiles), c.src, from_remote ? ", remote" : ""));
+	fs::remove(depfile, ec);
+	return;
+      }
+    }
+
+    const auto begin = std::chrono::steady_clock::now();
+    std::string worker{};
+    if (dist && local_compiles >= local_jobs && (have_preprocessed || preprocess())){
+      const bool c_lang = c.program == tc.cc && c.program != tc.cxx;
+      RemoteResult r{};
+      mux.started(label);
+      const bool remote = dist->compile(c_lang ? "c" : "c++", compiler_ids[c_lang ? 0 : 1], remote_args(tc, c.args, c.src), c.src, preprocessed,
+					b.deps->duration(c.obj), r);
+      // compiled locally after all, that's what counts as the job
+      mux.finished(label, remote);
+      if (remote){
+	worker = r.worker;
+	ret = r.ret;
+	output = std::move(r.output);
+	if (ret == 0){
+	  std::ofstream ofs(c.obj, std::ios::binary);
+	  ofs.write(r.object.data(), r.object.size());
+	  if (!ofs.good()){
+	    ret = 1;
+	    output += FMT("ERROR: Could not write {}\n", c.obj);
+	  }
+	}
+	if (!tc.msvc) fs::remove(depfile, ec);
+      }
+    }
+    if (worker.empty()){
+      local_compiles++;
+      if (tc.msvc){
+	// never passed through, the /showIncludes lines have to come out first
+	ret = mux.run(label, c.program, c.args, output);
+	span.set_proc(ret);
+	headers = parse_show_includes(output);
+	// cl.exe always echoes the name of the file it's compiling
+	if (str::trim(output) == fs::path(c.src).filename().string()) output.clear();
+      } else {
+	ret = mux.run(label, c.program, c.args, output, opts.live);
+	span.set_proc(ret);
+	if (opts.live) output.clear();
+	if (ret == 0) headers = parse_depfile(file::MappedFile(depfile).view());
+	fs::remove(depfile, ec);
+      }
+      local_compiles--;
+    }
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+    compiled();
+    size_t n = ++b.done;
+    if (ret != 0 && !c.members.empty()){
+      // compile the members on their own instead; whichever the errors point at stay that way
+      b.deps->forget(c.obj);
+      std::vector<std::string> blamed = blame_sources(output, c.members);
+      if (!opts.quiet) mux.emit(FMT("{}[{}/{}] {} FAILED, compiling its {} sources on their own\n", tag(b), n, size_t(b.compiles), c.src, c.members.size()));
+      b.compiles += c.members.size();
+      mux.add(c.members.size());
+      Target& t = *c.target;
+      {
+	std::lock_guard<std::mutex> lock(b.mtx);
+	std::erase(t.objs, c.obj);
+      }
+      for (auto& m : c.members){
+	CompileJob* single{nullptr};
+	{
+	  std::lock_guard<std::mutex> lock(graph_mtx);
+	  single = &compiles.emplace_back(single_job(b, t, m));
+	  // an error in a header can't be pinned on anyone, so everyone's to blame
+	  single->blamed = blamed.empty() || std::find(blamed.begin(), blamed.end(), m) != blamed.end();
+	}
+	fs::create_directories(fs::path(single->obj).parent_path());
+	{
+	  std::lock_guard<std::mutex> lock(b.mtx);
+	  t.objs.push_back(single->obj);
+	}
+	Node& member = add_node(Step::compile, b, t, single);
+	member.cost = node.cost / double(c.members.size());
+	if (t.link_node) edge(member, *t.link_node);
+	member.priority = member.cost + (t.link_node ? t.link_node->priority : 0);
+	ready(member);
+      }
+      return;
+    }
+    if (ret != 0){
+      b.failed = true;
+      b.deps->forget(c.obj);
+    } else {
+      b.deps->record(c.obj, c.cmd_hash, headers);
+      b.deps->record_duration(c.obj, uint32_t(ms));
+      if (c.blamed) b.deps->isolate(c.src);
+    }
+    if (ret == 0 && !key.empty()){
+      cache.misses++;
+      cache.store(key, c.obj);
+    }
+    if (!opts.quiet || !output.empty()){
+      const std::string where = worker.empty() ? std::string{} : FMT(" (on {})", worker);
+      std::string line = opts.quiet ? std::string{} : FMT("{}[{}/{}] {}{}{}\n", tag(b), n, size_t(b.compiles), c.src, where, ret != 0 ? " FAILED" : "");
+      mux.emit(line + output);
+    }
+  };
+
+  // false if it has to wait for memory
+  auto link = [&](Node& node){
+    ConfigBuild& b = *node.build;
+    Target& t = *node.target;
+    if (b.failed) return true;
+    std::vector<std::pair<std::string, std::string>> libs{};
+    for (auto& other : b.targets) libs.push_back({other.cfg.name, other.output});
+    std::vector<std::string> objs{};
+    {
+      std::lock_guard<std::mutex> lock(b.mtx);
+      objs = t.objs;
+    }
+    std::vector<std::string> inputs = objs;
+    for (auto& name : t.cfg.links){
+      for (auto& lib : libs) if (lib.first == name) inputs.push_back(lib.second);
+    }
+    LinkCmd cmd = link_cmd(tc, t.cfg, objs, t.output, libs, b.linker);
+    // a removed source changes the command but leaves every input older than the output
+    const uint64_t cmd_hash = command_hash(cmd.program, cmd.args);
+    if (!out_of_date(t.output, inputs) && b.deps->same_command(t.output, cmd_hash)) return true;
+
+    // what the last link of it peaked at, or a guess from the size of what goes in
+    uint64_t memory = b.deps->peak_memory(t.output);
+    if (!memory){
+      std::error_code ec;
+      for (auto& in : inputs) memory += fs::file_size(in, ec) * LINK_MEMORY_PER_INPUT_BYTE;
+    }
+    memory = std::min(std::max<uint64_t>(memory, LINK_MEMORY_MIN), link_memory);
+    {
+      std::lock_guard<std::mutex> lock(memory_mtx);
+      if (memory_in_use && memory_in_use + memory > link_memory){
+	parked.push_back(&node);
+	return false;
+      }
+      memory_in_use += memory;
+    }
+
+    if (!opts.quiet) mux.emit(FMT("{}: {}Linking {}...\n", "momobuild", tag(b), t.output));
+    const std::string label = tag(b) + t.output;
+    TraceSpan span("link", label);
+    fs::create_directories(fs::path(t.output).parent_path());
+    if (t.cfg.kind == "StaticLib") fs::remove(t.output);
+    std::string output{};
+    mux.add(1);
+    const auto begin = std::chrono::steady_clock::now();
+    int ret = mux.run(label, cmd.program, cmd.args, output, opts.live);
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count();
+    const uint64_t peak = proc::last_usage().peak_rss;
+    span.set_proc(ret);
+    link_ms += ms;
+    std::vector<Node*> retry{};
+    {
+      std::lock_guard<std::mutex> lock(memory_mtx);
+      memory_in_use -= memory;
+      retry.swap(parked);
+    }
+    for (auto* p : retry) ready(*p);
+
+    if (opts.live) output.clear();
+    if (ret != 0) output += FMT("ERROR: Linking {} failed with code {}\n", t.output, ret);
+    if (!output.empty()) mux.emit(output);
+    if (ret != 0){
+      b.failed = true;
+      link_ret = ret;
+      return true;
+    }
+    linked++;
+    b.deps->record(t.output, cmd_hash, {});
+    b.deps->record_duration(t.output, uint32_t(ms));
+    if (peak) b.deps->record_peak_memory(t.output, peak);
+    return true;
+  };
+
+  execute = [&](Node& n){
+    switch (n.step){
+    case Step::pch: precompile(n); return true;
+    case Step::compile: compile(n); return true;
+    case Step::link: return link(n);
+    }
+    return true;
+  };
+  ready = [&](Node& n){
+    sched.submit([&, np = &n](){
+      if (!execute(*np)) return;
+      for (auto* next : np->next){
+	if (--next->waiting == 0) ready(*next);
+      }
+    }, n.priority);
+  };
+  {
+    // the graph only grows from inside the jobs from here on
+    std::vector<Node*> roots{};
+    for (auto& n : nodes) if (n.waiting == 0) roots.push_back(&n);
+    for (auto* n : roots) ready(*n);
+  }
+  sched.run();
+  const int64_t total_ms = since_start();
+
+  if (cache.remote) cache.remote->finish();
+  if (cache.enabled() && (cache.hits || cache.misses)){
+    if (!cache.dir.empty()){
+      cache.update_stats();
+      if (cache.stored) cache.evict();
+    }
+    const std::string remote = cache.remote ? FMT(" ({} from {})", size_t(cache.remote_hits), cache.remote->address) : std::string{};
+    if (!opts.quiet) print("{}: Object cache: {} hit(s){}, {} miss(es)\n", "momobuild", size_t(cache.hits), remote, size_t(cache.misses));
+  }
+  if (!opts.quiet && (!compiles.empty() || linked)){
+    // links overlap the compiles, the part after the last compile is what they add to the build
+    print("{}: Compiling took {:.2f}s, linking {} target(s) {:.2f}s ({:.2f}s after the last compile) {}\n", "momobuild",
+	  double(last_compile_ms) / 1000, size_t(linked), double(link_ms) / 1000, double(total_ms - last_compile_ms) / 1000, config_list);
+  }
+  for (auto& b : builds){
+    const std::string path = BuildState::deps_path(b->config);
+    if (!b->deps->save(path)) fprint(std::cerr, "WARNING: Could not write {}\n", path);
+  }
+  if (!metadata().flush()) fprint(std::cerr, "WARNING: Could not write {}\n", METADATA_PATH);
+
+  for (auto& b : builds){
+    if (b->failed){
+      if (configs.size() > 1) fprint(std::cerr, "ERROR: Build failed [{}]\n", b->config);
+      return link_ret ? int(link_ret) : 1;
+    }
+  }
+  return 0;
+}
+
+// etags --------------------------------------------------
+// TAGS is a list of per file sections (`\f\npath,size\n<tags>`), so every
+// file's section is cached on its own and only files that changed since the
+// last run go through etags. The file lists go to etags on stdin in batches,
+// which keeps clear of command line limits, and the batches run in parallel.
+
+#define TAGS_PATH "TAGS"
+#define ETAGS_CACHE_PATH "build/etags.cache"
+#define ETAGS_CACHE_HEADER "momobuild-etags 2"
+#define ETAGS_BATCH_SIZE 512
+
+struct TagsSection {
+  int64_t mtime{0};
+  uint64_t size{0};
+  std::string text{};
+};
+
+// format: the header line, then for every file `path\nmtime size length\n` followed by `length` bytes of section
+std::unordered_map<std::string, TagsSection> load_tags_cache(const std::string& filename){
+  std::unordered_map<std::string, TagsSection> res{};
+  std::error_code ec;
+  if (!fs::exists(filename, ec)) return res;
+  const file::MappedFile data(filename);
+  std::string_view v = data.view();
+  if (!v.starts_with(ETAGS_CACHE_HEADER "\n")) return res;
+  v.remove_prefix(sizeof(ETAGS_CACHE_HEADER));
+  while (!v.empty()){
+    size_t nl = v.find('\n');
+    if (nl == std::string_view::npos) break;
+    std::string path{v.substr(0, nl)};
+    v.remove_prefix(nl + 1);
+    nl = v.find('\n');
+    if (nl == std::string_view::npos) break;
+    std::string meta{v.substr(0, nl)};
+    v.remove_prefix(nl + 1);
+    TagsSection sec{};
+    size_t len{0};
+    if (sscanf(meta.c_str(), "%lld %llu %zu", (long long*)&sec.mtime, (unsigned long long*)&sec.size, &len) != 3 || len > v.size()) break;
+    sec.text = std::string(v.substr(0, len));
+    v.remove_prefix(len);
+    res[path] = std::move(sec);
+  }
+  return res;
+}
+
+bool save_tags_cache(const std::string& filename, const std::unordered_map<std::string, TagsSection>& cache){
+  std::string out{ETAGS_CACHE_HEADER "\n"};
+  for (auto& [path, sec] : cache){
+    out += FMT("{}\n{} {} {}\n", path, sec.mtime, sec.size, sec.text.size());
+    out += sec.text;
+  }
+  std::string tmp = filename + ".tmp";
+  {
+    std::ofstream ofs(tmp, std::ios::binary);
+    if (!ofs.is_open()) return false;
+    ofs.write(out.data(), out.size());
+  }
+  std::error_code ec;
+  fs::rename(tmp, filename, ec);
+  return !ec;
+}
+
+// splits etags output into (path, section) pairs
+std::vector<std::pair<std::string, std::string>> split_tags(const std::string& tags){
+  std::vector<std::pair<std::string, std::string>> res{};
+  size_t pos = tags.find("\f\n");
+  while (pos != std::string::npos){
+    size_t next = tags.find("\f\n", pos + 2);
+    size_t header_end = tags.find('\n', pos + 2);
+    if (header_end == std::string::npos) break;
+    std::string header = tags.substr(pos + 2, header_end - pos - 2);
+    size_t comma = header.rfind(',');
+    if (comma != std::string::npos){
+      res.push_back({header.substr(0, comma), tags.substr(pos, next == std::string::npos ? std::string::npos : next - pos)});
+    }
+    pos = next;
+  }
+  return res;
+}
+
+// brings TAGS up to date with `files`, returns the etags exit code
+int update_tags(const std::vector<std::string_view>& files, size_t jobs, bool quiet){
+  if (jobs == 0) jobs = std::max<size_t>(1, std::thread::hardware_concurrency());
+  std::unordered_map<std::string, TagsSection> cache = load_tags_cache(ETAGS_CACHE_PATH);
+
+  // stat everything in parallel
+  std::vector<std::pair<int64_t, uint64_t>> stats(files.size());
+  const size_t chunk = 1024;
+  {
+    Scheduler sched(jobs);
+    for (size_t start = 0; start < files.size(); start += chunk){
+      sched.submit([&, start](){
+	for (size_t i = start; i < std::min(files.size(), start + chunk); ++i){
+	  std::error_code ec;
+	  fs::path p{files[i]};
+	  stats[i] = {int64_t(fs::last_write_time(p, ec).time_since_epoch().count()), uint64_t(fs::file_size(p, ec))};
+	}
+      });
+    }
+    sched.run();
+  }
+
+  std::vector<size_t> stale{};
+  std::unordered_set<std::string_view> present{};
+  for (size_t i = 0; i < files.size(); ++i){
+    present.insert(files[i]);
+    auto it = cache.find(std::string(files[i]));
+    if (it == cache.end() || it->second.mtime != stats[i].first || it->second.size != stats[i].second) stale.push_back(i);
+  }
+  const size_t removed = std::erase_if(cache, [&](const auto& kv){ return !present.contains(kv.first); });
+
+  std::error_code ec;
+  if (stale.empty() && removed == 0 && fs::exists(TAGS_PATH, ec)){
+    // through the mux, the build may be drawing its status line
+    if (!quiet) output_mux().emit(FMT("\n{}: TAGS is up to date...\n", "momobuild"));
+    return 0;
+  }
 
-#define MSBUILD_PATH "D:\\bin\\Microsoft Visual Studio\\Community\\MSBuild\\Current\\Bin\\MSBuild.exe"
-#define PREMAKE5_PATH "D:\\bin\\premake 5.0 beta2\\premake5.exe"
-#define VCREDIST_PATH "D:\\bin\\Microsoft Visual Studio\\Community\\VC\\Redist\\MSVC\\14.36.32532\\"
-#define VCREDIST_EXE "vc_redist."
-#define GITIGNORE_TEMPLATE "bin\n"   \
-                           "lib\n"   \
-			   "build\n" \
-			   "*~\n"
-#define MSBUILD_OPTIONS "-warnAsMessage:LNK4006"
+  if (!quiet) output_mux().emit(FMT("\n{}: Running etags on {} of {} file(s)...\n", "momobuild", stale.size(), files.size()));
+  fs::create_directories("build", ec);
+  std::atomic<int> ret{0};
+  std::mutex cache_mtx{};
+  // small enough that every job gets a batch, capped so no single etags run drags on
+  const size_t batch = std::clamp<size_t>((stale.size() + jobs - 1) / jobs, 1, ETAGS_BATCH_SIZE);
+  {
+    Scheduler sched(jobs);
+    for (size_t start = 0; start < stale.size(); start += batch){
+      sched.submit([&, start](){
+	const size_t end = std::min(stale.size(), start + batch);
+	std::string names{};
+	for (size_t i = start; i < end; ++i){
+	  names += files[stale[i]];
+	  names += '\n';
+	}
+	// etags names the files relative to the tag file, so it's written next to TAGS
+	// and the names in it come back the way they were given
+	const std::string out = FMT("{}.{}.tmp", TAGS_PATH, start);
+	int r = proc::run_with_input("etags", {"-o", out, "-"}, names);
+	if (r != 0){
+	  ret = r;
+	  return;
+	}
+	std::unordered_map<std::string, std::string> sections{};
+	for (auto& [path, text] : split_tags(file::slurp_file(out))) sections[path] = std::move(text);
+	std::error_code rec;
+	fs::remove(out, rec);
 
-#define VERSION ("0.0.4")
+	// tags that match none of the files would leave TAGS empty, and cached as if it weren't
+	bool matched = false;
+	for (size_t i = start; i < end && !matched; ++i) matched = sections.contains(std::string(files[stale[i]]));
+	if (!sections.empty() && !matched){
+	  fprint(std::cerr, "ERROR: etags named the files differently than they were given (`{}`)\n", sections.begin()->first);
+	  ret = 1;
+	  return;
+	}
 
-// HOME is a environment variable defined to `C:\Users\<username>\`
-#define PREMAKE5_TEMPLATE_PATH FMT("{}\\.emacs.d\\snippets\\lua-mode\\premake5", get_env("HOME"))
+	std::lock_guard<std::mutex> lock(cache_mtx);
+	for (size_t i = start; i < end; ++i){
+	  std::string path{files[stale[i]]};
+	  TagsSection sec{stats[stale[i]].first, stats[stale[i]].second, {}};
+	  auto it = sections.find(path);
+	  // a file without any tags still gets an (empty) section
+	  sec.text = it != sections.end() ? std::move(it->second) : FMT("\f\n{},0\n", path);
+	  cache[path] = std::move(sec);
+	}
+      });
+    }
+    sched.run();
+  }
+  if (ret != 0) return ret;
 
-static std::vector<std::string> source_suffixes = {
-  ".hpp",
-  ".cpp"
+  // files come sorted from the scanner, so TAGS is stable between runs
+  std::string tags{};
+  for (auto& f : files){
+    auto it = cache.find(std::string(f));
+    if (it != cache.end()) tags += it->second.text;
+  }
+  {
+    std::ofstream ofs(TAGS_PATH ".tmp", std::ios::binary);
+    if (!ofs.is_open()){
+      fprint(std::cerr, "ERROR: Could not open {} for writing\n", TAGS_PATH ".tmp");
+      return 1;
+    }
+    ofs.write(tags.data(), tags.size());
+  }
+  fs::rename(TAGS_PATH ".tmp", TAGS_PATH, ec);
+  if (ec){
+    fprint(std::cerr, "ERROR: Could not write {}\n", TAGS_PATH);
+    return 1;
+  }
+  if (!save_tags_cache(ETAGS_CACHE_PATH, cache)) fprint(std::cerr, "WARNING: Could not write {}\n", ETAGS_CACHE_PATH);
+  return 0;
+}
+
+// watch --------------------------------------------------
+// `momobuild watch` stays resident and rebuilds as soon as something changes.
+// On linux every directory of the tree gets an inotify watch, elsewhere the
+// tree is polled. Events are collected until the tree has been quiet for
+// WATCH_DEBOUNCE_MS, so saving a dozen files at once is one rebuild.
+// build/, bin/, hidden dirs and whatever the root .gitignore lists are not watched.
+
+#define WATCH_DEBOUNCE_MS 100
+#define WATCH_POLL_MS 500
+
+struct WatchChanges {
+  std::vector<std::string> paths{}; // relative to the root dir
+  bool tree_changed{false};         // files were added, removed or renamed
+  bool premake_changed{false};      // a .lua script changed
+  bool overflowed{false};           // events were lost, assume everything changed
 };
 
-void collect_source_files(std::string& collector, const std::string& dir, const std::string& og_dir){
-  win::change_dir(dir);
-  for (auto& e : win::get_entries_in_dir(".")){
-    if (e.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY){
-      std::string dir_name{e.cFileName};
-      // skip dirs starting with `.`
-      if (dir_name.starts_with(".")) continue;
-      collect_source_files(collector, dir_name, og_dir);
-    } else {
-      std::string file_name{e.cFileName};
-      ASSERT(!file_name.empty());
-      // skip files starting with `.`
-      if (file_name.starts_with(".")) continue;
-      for (auto& s : source_suffixes){
-	if (file_name.ends_with(s)){
-	  if (!collector.empty())
-	    collector += " ";
-	  file_name = fs::absolute(fs::path(file_name)).string();
-	  collector += file_name;
+struct Watcher {
+  std::vector<IgnoreRule> rules{};
+#if defined __linux__
+  int fd{-1};
+  std::unordered_map<int, std::string> dirs{}; // watch descriptor -> dir relative to the root
+#else
+  std::unordered_map<std::string, fs::file_time_type> files{};
+#endif
+
+  Watcher(){
+    std::error_code ec;
+    rules = parse_ignore_rules("build/\nbin/\n", "");
+    if (fs::exists(".gitignore", ec)){
+      for (auto& r : parse_ignore_rules(file::slurp_file(".gitignore"), "")) rules.push_back(std::move(r));
+    }
+#if defined __linux__
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) ERR("inotify_init1() -> {}\n", strerror(errno));
+    add_tree("");
+#else
+    files = snapshot();
+#endif
+  }
+
+  ~Watcher(){
+#if defined __linux__
+    if (fd >= 0) close(fd);
+#endif
+  }
+
+#if defined __linux__
+  void add_tree(const std::string& rel_dir){
+    const uint32_t mask = IN_CLOSE_WRITE | IN_ATTRIB | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF;
+    int wd = inotify_add_watch(fd, rel_dir.empty() ? "." : rel_dir.c_str(), mask);
+    if (wd < 0){
+      fprint(std::cerr, "WARNING: Could not watch {}: {}\n", rel_dir.empty() ? "." : rel_dir, strerror(errno));
+      return;
+    }
+    dirs[wd] = rel_dir;
+    std::error_code ec;
+    for (auto it = fs::directory_iterator(rel_dir.empty() ? fs::path(".") : fs::path(rel_dir), fs::directory_options::skip_permission_denied, ec); !ec && it != fs::directory_iterator(); it.increment(ec)){
+      std::error_code eec;
+      if (!it->is_directory(eec) || it->is_symlink(eec)) continue;
+      const std::string name = it->path().filename().string();
+      if (name.starts_with(".")) continue;
+      std::string rel = rel_dir.empty() ? name : FMT("{}/{}", rel_dir, name);
+      if (!is_ignored(rules, rel, true)) add_tree(rel);
+    }
+  }
+#else
+  std::unordered_map<std::string, fs::file_time_type> snapshot(){
+    ScanOptions opts{};
+    opts.read_gitignore = true;
+    opts.excludes = {"build/", "bin/"};
+    std::unordered_map<std::string, fs::file_time_type> res{};
+    std::error_code ec;
+    for (auto& f : scan_tree(".", opts)) res[std::string(f)] = fs::last_write_time(f, ec);
+    return res;
+  }
+#endif
+
+  // blocks until something changed and the tree has settled down
+  WatchChanges wait(){
+    WatchChanges res{};
+    std::unordered_set<std::string> seen{};
+    auto add = [&](const std::string& rel){
+      if (rel.ends_with(".lua")) res.premake_changed = true;
+      if (seen.insert(rel).second) res.paths.push_back(rel);
+    };
+    auto settled = [&](){ return !res.paths.empty() || res.tree_changed || res.overflowed; };
+#if defined __linux__
+    alignas(inotify_event) char buf[64 * 1024];
+    int timeout{-1};
+    for (;;){
+      pollfd pfd{fd, POLLIN, 0};
+      int n = poll(&pfd, 1, timeout);
+      if (n < 0){
+	if (errno == EINTR) continue;
+	ERR("poll() -> {}\n", strerror(errno));
+      }
+      if (n == 0){
+	if (settled()) return res;
+	timeout = -1;
+	continue;
+      }
+      ssize_t len{0};
+      while ((len = read(fd, buf, sizeof(buf))) > 0){
+	for (char* p = buf; p < buf + len;){
+	  const inotify_event* ev = (const inotify_event*)p;
+	  p += sizeof(inotify_event) + ev->len;
+	  if (ev->mask & IN_Q_OVERFLOW){
+	    res.overflowed = true;
+	    continue;
+	  }
+	  auto it = dirs.find(ev->wd);
+	  if (it == dirs.end()) continue;
+	  if (ev->mask & IN_IGNORED){
+	    dirs.erase(it);
+	    continue;
+	  }
+	  if (ev->len == 0) continue;
+	  const std::string name{ev->name};
+	  if (name.starts_with(".")) continue;
+	  const std::string rel = it->second.empty() ? name : FMT("{}/{}", it->second, name);
+	  const bool is_dir = ev->mask & IN_ISDIR;
+	  if (is_ignored(rules, rel, is_dir)) continue;
+	  if (ev->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) res.tree_changed = true;
+	  if (is_dir){
+	    if (ev->mask & (IN_CREATE | IN_MOVED_TO)) add_tree(rel);
+	    continue;
+	  }
+	  add(rel);
+	}
+      }
+      // keep collecting until nothing happened for a while
+      timeout = WATCH_DEBOUNCE_MS;
+    }
+#else
+    for (;;){
+      std::this_thread::sleep_for(std::chrono::milliseconds(settled() ? WATCH_DEBOUNCE_MS : WATCH_POLL_MS));
+      auto now = snapshot();
+      bool changed{false};
+      for (auto& [path, time] : now){
+	auto it = files.find(path);
+	if (it == files.end()) res.tree_changed = true;
+	if (it == files.end() || it->second != time){
+	  add(path);
+	  changed = true;
 	}
       }
+      for (auto& [path, time] : files){
+	if (!now.contains(path)){
+	  res.tree_changed = true;
+	  add(path);
+	  changed = true;
+	}
+      }
+      files = std::move(now);
+      if (!changed && settled()) return res;
+    }
+#endif
+  }
+};
+
+// the closest parent of `dir` (or `dir` itself) that has a ROOT_IDENTIFIER, empty if there is none
+fs::path find_root_dir(fs::path dir){
+  std::error_code ec;
+  while (!dir.empty()){
+    if (fs::exists(dir / ROOT_IDENTIFIER, ec)) return dir;
+    if (dir == dir.parent_path()) break;
+    dir = dir.parent_path();
+  }
+  return {};
+}
+
+// name of the project `run` should start: the startproject, else the first application
+std::string native_project_name(const Workspace& wks){
+  if (!wks.startproject.empty()) return wks.startproject;
+  for (auto& prj : wks.projects){
+    ProjectConfig cfg = resolve_project(wks, prj, wks.configurations[0]);
+    if (cfg.kind == "ConsoleApp" || cfg.kind == "WindowedApp") return cfg.targetname;
+  }
+  return wks.projects.empty() ? std::string{} : wks.projects[0].name;
+}
+
+// tests --------------------------------------------------
+// `momobuild test` runs the test executables of the built configurations side
+// by side, the ones that took longest last time first. A test is an application
+// with `test` in its name, or one the .topdir's `tests` lists. It passes if it
+// exits with 0 within the timeout; a failing one gets up to `retries` more
+// attempts and is flaky if one of them passes. The results can be written as
+// JUnit XML or JSON for CI.
+
+struct TestOptions {
+  size_t jobs{0};         // 0 is one per core
+  uint32_t timeout_ms{0}; // of every attempt, 0 is none
+  size_t retries{0};
+  bool quiet{false};
+  bool live{false};
+};
+
+struct TestResult {
+  std::string name{};
+  std::string config{};
+  std::string exe{};     // relative to the root dir
+  int ret{0};            // of the last attempt
+  bool timed_out{false}; // the last attempt
+  size_t attempts{0};
+  double ms{0};          // of the last attempt
+  std::string output{};  // of the last attempt
+
+  bool passed() const { return attempts > 0 && ret == 0; }
+  bool flaky() const { return passed() && attempts > 1; }
+};
+
+// the test executables of `config`
+std::vector<TestResult> test_targets(const Workspace& wks, const std::string& config){
+  std::vector<std::string> listed{};
+  for (auto& a : str::split_by(str::replace(tool_cache().topdir["tests"], ",", " "), ' ')){
+    if (!str::trim(a).empty()) listed.push_back(str::trim(a));
+  }
+  std::vector<TestResult> res{};
+  for (auto& prj : wks.projects){
+    ProjectConfig cfg = resolve_project(wks, prj, config);
+    if (cfg.kind != "ConsoleApp" && cfg.kind != "WindowedApp") continue;
+    const bool is_test = listed.empty() ? str::tolower(prj.name).find("test") != std::string::npos
+      : std::find(listed.begin(), listed.end(), prj.name) != listed.end();
+    if (!is_test) continue;
+    TestResult t{};
+    t.name = prj.name;
+    t.config = config;
+    t.exe = (fs::path(cfg.targetdir) / FMT("{}{}", cfg.targetname, EXE_SUFFIX)).generic_string();
+    res.push_back(t);
+  }
+  return res;
+}
+
+// keeps the `shard`th (from 1) of `shards` slices; sorted first so every machine slices the same list
+void shard_tests(std::vector<TestResult>& tests, size_t shard, size_t shards){
+  std::sort(tests.begin(), tests.end(), [](const TestResult& a, const TestResult& b){
+    return a.config != b.config ? a.config < b.config : a.name < b.name;
+  });
+  std::vector<TestResult> res{};
+  for (size_t i = 0; i < tests.size(); ++i){
+    if (i % shards == shard - 1) res.push_back(std::move(tests[i]));
+  }
+  tests = std::move(res);
+}
+
+// runs `tests` from the root dir and fills in their results, `args` go to every one of them
+void run_tests(std::vector<TestResult>& tests, const std::vector<std::string>& args, const TestOptions& opts){
+  const size_t jobs = opts.jobs ? opts.jobs : std::max<size_t>(1, std::thread::hardware_concurrency());
+  Scheduler sched(std::min(jobs, std::max<size_t>(1, tests.size())));
+  output_mux().begin(tests.size());
+  for (auto& t : tests){
+    sched.submit([&](){
+      const std::string label = FMT("{} [{}]", t.name, t.config);
+      const std::string exe = fs::absolute(t.exe).string();
+      const bool built = fs::exists(t.exe);
+      TraceSpan span("test", label);
+      while (t.attempts <= opts.retries){
+	// a retry is one more job for the status line's counter
+	if (t.attempts++ > 0) output_mux().add(1);
+	t.output.clear();
+	t.timed_out = false;
+	auto start = std::chrono::steady_clock::now();
+	t.ret = built ? output_mux().run(label, exe, args, t.output, opts.live, opts.timeout_ms, &t.timed_out) : 1;
+	t.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	if (!built) t.output = FMT("{} doesn't exist, was it built?\n", t.exe);
+	if (t.ret == 0 || !built) break;
+      }
+      span.set_proc(t.ret);
+      span.end();
+      metadata().set(FMT("test_duration {}", t.exe), std::to_string(uint64_t(t.ms)));
+
+      if (opts.live && t.passed()) t.output.clear();
+      std::string line{};
+      if (t.flaky()) line = FMT("{}: {} passed on attempt {} in {:.0f} ms (flaky)\n", "momobuild", label, t.attempts, t.ms);
+      else if (t.passed()) line = FMT("{}: {} passed in {:.0f} ms\n", "momobuild", label, t.ms);
+      else if (t.timed_out) line = FMT("{}: {} timed out after {} ms\n", "momobuild", label, opts.timeout_ms);
+      else line = FMT("{}: {} failed with exit code {}\n", "momobuild", label, t.ret);
+      if (!t.passed()) output_mux().emit(line + (opts.live ? std::string{} : t.output));
+      else if (!opts.quiet) output_mux().emit(line);
+    }, double(metadata_number(FMT("test_duration {}", t.exe))));
+  }
+  sched.run();
+  if (!metadata().flush()) fprint(std::cerr, "WARNING: Could not write {}\n", METADATA_PATH);
+}
+
+std::string xml_escape(std::string_view s){
+  std::string res{};
+  res.reserve(s.size());
+  for (const char& c : s){
+    switch (c){
+    case '&':  res += "&amp;"; break;
+    case '<':  res += "&lt;"; break;
+    case '>':  res += "&gt;"; break;
+    case '"':  res += "&quot;"; break;
+    case '\'': res += "&apos;"; break;
+    case '\n': case '\r': case '\t': res += c; break;
+    default:
+      // XML 1.0 has no way to write the other control characters
+      if ((unsigned char)c < 0x20) res += '?';
+      else res += c;
+    }
+  }
+  return res;
+}
+
+// a testsuite per configuration, a testcase per test
+std::string junit_report(const std::vector<TestResult>& tests){
+  std::vector<std::string> configs{};
+  size_t failures{0};
+  double ms{0};
+  for (auto& t : tests){
+    if (std::find(configs.begin(), configs.end(), t.config) == configs.end()) configs.push_back(t.config);
+    if (!t.passed()) failures++;
+    ms += t.ms;
+  }
+  std::string res = "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n";
+  res += FMT("<testsuites name=\"momobuild\" tests=\"{}\" failures=\"{}\" time=\"{:.3f}\">\n", tests.size(), failures, ms / 1000);
+  for (auto& c : configs){
+    std::string cases{};
+    size_t n{0}, failed{0};
+    double suite_ms{0};
+    for (auto& t : tests){
+      if (t.config != c) continue;
+      n++;
+      suite_ms += t.ms;
+      cases += FMT("    <testcase name=\"{}\" classname=\"{}\" time=\"{:.3f}\">\n", xml_escape(t.name), xml_escape(c), t.ms / 1000);
+      if (!t.passed()){
+	failed++;
+	const std::string message = t.timed_out ? std::string("timed out") : FMT("exit code {}", t.ret);
+	cases += FMT("      <failure message=\"{}\"/>\n", message);
+      }
+      if (!t.output.empty()) cases += FMT("      <system-out>{}</system-out>\n", xml_escape(t.output));
+      if (t.flaky()) cases += FMT("      <system-err>flaky: passed on attempt {}</system-err>\n", t.attempts);
+      cases += "    </testcase>\n";
     }
+    res += FMT("  <testsuite name=\"{}\" tests=\"{}\" failures=\"{}\" time=\"{:.3f}\">\n", xml_escape(c), n, failed, suite_ms / 1000);
+    res += cases;
+    res += "  </testsuite>\n";
+  }
+  res += "</testsuites>\n";
+  return res;
+}
+
+std::string json_report(const std::vector<TestResult>& tests){
+  size_t passed{0}, flaky{0};
+  for (auto& t : tests){
+    if (t.passed()) passed++;
+    if (t.flaky()) flaky++;
   }
-  if (fs::current_path().string() != og_dir){
-    win::change_dir("..\\");
+  std::string res = FMT("{{\n  \"passed\": {},\n  \"failed\": {},\n  \"flaky\": {},\n  \"tests\": [\n", passed, tests.size() - passed, flaky);
+  for (size_t i = 0; i < tests.size(); ++i){
+    const TestResult& t = tests[i];
+    const char* status = t.passed() ? "passed" : t.timed_out ? "timed_out" : "failed";
+    res += FMT("    {{\"name\": \"{}\", \"config\": \"{}\", \"exe\": \"{}\", \"status\": \"{}\", \"exit_code\": {}, \"attempts\": {}, \"flaky\": {}, \"ms\": {:.3f}, \"output\": \"{}\"}}{}\n",
+	       json_escape(t.name), json_escape(t.config), json_escape(t.exe), status, t.ret, t.attempts, t.flaky() ? "true" : "false", t.ms,
+	       json_escape(t.output), i + 1 < tests.size() ? "," : "");
   }
+  res += "  ]\n}\n";
+  return res;
 }
 
 int main(int argc, char *argv[]) {
   ARG();
   std::cout << std::unitbuf;
   std::cerr << std::unitbuf;
+#if !defined USE_WINAPI
+  // a child that exits before reading all of its stdin shouldn't take momobuild down with it
+  signal(SIGPIPE, SIG_IGN);
+#endif
 
   std::string program = arg.pop();
 
@@ -98,27 +4587,59 @@ int main(int argc, char *argv[]) {
   bool will_clean = false;
   bool will_reset = false;
   bool will_etags = false;
+  bool will_show_cache = false;
+  bool will_watch = false;
+  bool will_show_toolchain = false;
+  bool will_work = false;
+  bool will_serve_cache = false;
+  std::string cache_server_listen = FMT(":{}", REMOTE_CACHE_PORT);
+  std::string worker_listen = FMT(":{}", WORKER_PORT);
   bool will_init = false;
   bool will_show_version = false;
   bool open_sln = false;
   bool force = false;
+  bool force_regen = false;
+#if defined USE_WINAPI
+  bool native = false;
+#else
+  bool native = true;
+#endif
+  BuildOptions build_opts{};
   bool executable_name_provided = false;
   std::string executable_name;
+  bool will_build = false;
+  bool will_open_dir = false;
   bool will_run = false;
   bool will_srun = false;
+  bool will_test = false;
+  TestOptions test_opts{};
+  size_t test_shard{1};
+  size_t test_shards{1};
+  std::string junit_path{};
+  std::string json_path{};
   std::string og_dir = fs::current_path().string();
   std::string root_dir;
   std::string config = "";
   std::vector<std::string> valid_configs = {"Debug", "Release", "All"};
+  // the configurations premake5.lua declares are valid too
+  {
+    fs::path root = find_root_dir(fs::current_path());
+    if (!root.empty() && fs::exists(root / "premake5.lua")){
+      for (auto& c : lua_call_args(lua_strip_comments(file::MappedFile((root / "premake5.lua").string()).view()), "configurations")){
+	if (std::find(valid_configs.begin(), valid_configs.end(), c) == valid_configs.end()) valid_configs.push_back(c);
+      }
+    }
+  }
   std::string executable_args;
   std::string project_name;
 
   auto help = [&](){
-    print("Usage: {} [flags] [config] [subcmd] {{executable_args...}}\n", program);
+    print("Usage: {} [flags] [config] [subcmd...] [--] {{executable_args...}}\n", program);
     print("\nConfigs: \n"
           "    Debug (default)\n"
           "    Release\n"
-	  "    All\n"
+	  "    All                      - Every configuration in premake5.lua, built concurrently.\n"
+	  "    <config>,<config>...     - Several configurations (from above or premake5.lua), built concurrently.\n"
 
 	  "\nFlags: \n"
 	  "    /Q                       - Quiet mode; do not output anything\n"
@@ -129,24 +4650,56 @@ int main(int argc, char *argv[]) {
 	  "run subcommand is treated as the executable_name to run.\n"
 	  "    /v                       - Prints the version of momobuild.\n"
 	  "    /Y                       - Will answer `yes` on all confirmations.\n"
+	  "    /regen                   - Run premake5 even if premake5.lua and the project files haven't changed.\n"
+	  "    /native                  - Compile and link directly instead of going through premake5 and msbuild (default outside windows).\n"
+	  "    /msbuild                 - Build through premake5 and msbuild (make outside windows).\n"
+	  "    /j,-j <jobs>             - Number of parallel compile jobs for the native build (default: one per core).\n"
+	  "    /nocache                 - Don't use the object cache for this build.\n"
+	  "    /live                    - Print the compilers' output as it comes instead of once each job is done.\n"
+	  "    /nopch                   - Don't precompile the headers most sources of a project start with.\n"
+	  "    /unity                   - Compile every project's sources in batches balanced by how long they took last time (for full builds).\n"
+	  "    /local                   - Don't hand compiles to the workers in MOMOBUILD_WORKERS or the .topdir's `workers`.\n"
+	  "    /trace <file>            - Writes a timeline of the build to <file> (chrome://tracing, ui.perfetto.dev).\n"
+	  "    /timeout <seconds>       - Kills a test that runs longer and counts it as failed.\n"
+	  "    /retries <n>             - Runs a failing test up to <n> more times, it's flaky if one of them passes.\n"
+	  "    /shard <i>/<n>           - Runs only the <i>th (from 1) of <n> equal slices of the tests.\n"
+	  "    /junit <file>            - Writes the test results to <file> as JUnit XML.\n"
+	  "    /json <file>             - Writes the test results to <file> as JSON.\n"
 
-	  "\nSubcommands: \n"
+	  "\nSubcommands (several run in this order, whatever order they're given in: toolchain, reset, clean, sln,\n"
+	  "build and etags alongside each other, test, dir, run/srun; everything after run, srun or -- goes to the program\n"
+	  "and to every test): \n"
 	  "    help                     - Displays how to use this script.\n"
+	  "    build                    - Builds the config; implied when there's no other subcommand than run.\n"
 	  "    init [project_name]      - Initializes the project folder. optional arg [project_name] can be passed.\n"
 	  "    reset                    - Resets the project folder.\n"
 	  "    run                      - Runs the builded program.\n"
 	  "    srun                     - Runs the builded program as a new process.\n"
+	  "    test                     - Runs the applications with `test` in their name (or the .topdir's `tests`)\n"
+	  "                               from the root dir, as many at once as /j says.\n"
 	  "    dir                      - Opens the directory of the builded program.\n"
 	  "    clean                    - Cleans the left-over things from the last build.\n"
 	  "    sln                      - Opens the .sln file of the project.\n"
-	  "    etags                    - Runs etags on every source files in the project\n");
+	  "    etags                    - Runs etags on every source files in the project\n"
+	  "    watch [run]              - Rebuilds (and runs with `run`) every time a source file changes, until interrupted.\n"
+	  "    toolchain                - Shows the tools momobuild found and what the compilers reported about themselves.\n"
+	  "    cache                    - Shows the object cache's location, size and hit rate.\n"
+	  "                               MOMOBUILD_CACHE_DIR and MOMOBUILD_CACHE_SIZE (e.g. 5G) configure it.\n"
+	  "    worker [address]         - Compiles for other machines' native builds on <address>: host:port, :port or\n"
+	  "                               unix:<path> (default: :{}), with as many jobs as /j says. It runs whatever\n"
+	  "                               compiles it's sent, only make it reachable from machines you trust.\n"
+	  "    cache-server [address]   - Serves a remote cache on <address> (default: :{}) out of MOMOBUILD_CACHE_SERVER_DIR\n"
+	  "                               (default: `shared` in the object cache's dir), within MOMOBUILD_CACHE_SIZE.\n"
+	  "                               Builds use it through MOMOBUILD_REMOTE_CACHE (http://host:port/prefix, unix:<path>).\n",
+	  WORKER_PORT, REMOTE_CACHE_PORT);
     exit(0);
   };
 
   /* changes to the project root dir */
   auto change_to_root_dir = [&]() {
+    TraceSpan span("momobuild", "find root dir");
     while (!fs::exists(ROOT_IDENTIFIER) && !fs::current_path().stem().string().empty()) {
-      win::change_dir("..\\");
+      fs::current_path("..");
     }
     root_dir = fs::current_path().string();
     if (fs::current_path().stem().string().empty()){
@@ -161,7 +4714,6 @@ int main(int argc, char *argv[]) {
   auto confirmation = [&](const std::string question, bool _default=true){
     if (force) return true;
     std::string response{"AAA"};
-    str::tolower(response);
     auto valid = [&](const std::string& str){ return str=="" || str=="y" || str=="yes" || str=="n" || str=="no"; };
 
     do {
@@ -172,21 +4724,72 @@ int main(int argc, char *argv[]) {
       print("{} [yes/no]{{default: {}}}\n", question, _default  ? "yes" : "no");
 
       std::getline(std::cin, response);
+      response = str::tolower(str::trim(response));
     } while (!valid(response));
     return ((_default && response=="") || response=="y" || response=="yes") ? true : false;
   };
 
-  // get the project name from the `.sln` file in `.\build`
+  // get the project name from the generated project file in `.\build`
+  // (the `.sln` with vs2022, the per-project `.make` with gmake2)
+  // premake5.lua, parsed the first time it's needed
+  Option<Workspace> parsed_workspace{};
+  auto workspace = [&]() -> const Workspace& {
+    if (!parsed_workspace) parsed_workspace = parse_workspace();
+    return parsed_workspace.unwrap();
+  };
+
+  // the toolchain and dependency databases, shared by everything in this run
+  std::unique_ptr<BuildState> build_state_ptr{};
+  auto build_state = [&]() -> BuildState& {
+    if (!build_state_ptr) build_state_ptr = std::make_unique<BuildState>();
+    return *build_state_ptr;
+  };
+
+  bool project_name_resolved = false;
   auto get_project_name = [&]() {
-    win::change_dir("build");
-      WIN32_FIND_DATAA file_data{};
-      if (FindFirstFileA("*.sln", &file_data) == INVALID_HANDLE_VALUE){
-        ERR("Could not find .sln file in `build\\`\n\nNOTE: Please build the project first\n");
+    if (project_name_resolved) return;
+    project_name_resolved = true;
+    TraceSpan span("momobuild", "get_project_name");
+    if (native){
+      project_name = native_project_name(workspace());
+      if (project_name.empty()) ERR("premake5.lua doesn't declare any project\n");
+      return;
+    }
+#if defined USE_WINAPI
+    const std::string project_ext = ".sln";
+#else
+    const std::string project_ext = ".make";
+#endif
+    project_name.clear();
+    if (fs::is_directory("build")){
+      for (auto& e : fs::directory_iterator("build")){
+        if (e.path().extension() == project_ext){
+          project_name = e.path().stem().string();
+          break;
+        }
+      }
+    }
+    if (project_name.empty()){
+      ERR("Could not find {} file in `build\\`\n\nNOTE: Please build the project first\n", project_ext);
+    }
+  };
+
+  // the configurations `config` stands for; "All" is every configuration in premake5.lua
+  auto config_names = [&]() {
+    std::vector<std::string> res{};
+    if (config == "All"){
+      res = workspace().configurations;
+    } else {
+      size_t start{0};
+      while (start <= config.size()){
+	size_t end = config.find(',', start);
+	if (end == std::string::npos) end = config.size();
+	if (end > start) res.push_back(config.substr(start, end - start));
+	start = end + 1;
       }
-      project_name = file_data.cFileName;
-      // remove `.sln` from the filename
-      for (size_t i = 0; i < 4; ++i) project_name.pop_back();
-      win::change_dir("..\\");
+    }
+    if (res.empty()) res.push_back("Debug");
+    return res;
   };
 
   auto delete_file = [&](const std::string& file){
@@ -203,15 +4806,81 @@ int main(int argc, char *argv[]) {
     return 0;
   };
 
+  auto parse_jobs = [&](const std::string& n){
+    try {
+      build_opts.jobs = std::stoul(n);
+    } catch (...) {
+      fprint(std::cerr, "ERROR: Invalid number of jobs `{}`\n", n);
+      exit(1);
+    }
+  };
+
+  auto parse_timeout = [&](const std::string& n){
+    try {
+      const double seconds = std::stod(n);
+      if (seconds <= 0) throw std::invalid_argument(n);
+      test_opts.timeout_ms = uint32_t(std::max(1.0, std::min(seconds * 1000, double(UINT32_MAX))));
+    } catch (...) {
+      fprint(std::cerr, "ERROR: Invalid timeout `{}`, expected seconds\n", n);
+      exit(1);
+    }
+  };
+
+  auto parse_retries = [&](const std::string& n){
+    try {
+      test_opts.retries = std::stoul(n);
+    } catch (...) {
+      fprint(std::cerr, "ERROR: Invalid number of retries `{}`\n", n);
+      exit(1);
+    }
+  };
+
+  // `2/4`
+  auto parse_shard = [&](const std::string& s){
+    const size_t slash = s.find('/');
+    try {
+      if (slash == std::string::npos) throw std::invalid_argument(s);
+      test_shard = std::stoul(s.substr(0, slash));
+      test_shards = std::stoul(s.substr(slash + 1));
+    } catch (...) {
+      test_shards = 0;
+    }
+    if (test_shards == 0 || test_shard == 0 || test_shard > test_shards){
+      fprint(std::cerr, "ERROR: Invalid shard `{}`, expected <i>/<n> with 1 <= i <= n\n", s);
+      exit(1);
+    }
+  };
+
   std::vector<Flag> flags = {
-    {false, "/Q",    [&]() { quiet = true; }},
+    {false, "/Q",    [&]() { quiet = true; output_mux().status = false; }},
     {false, "/Rdst", [&]() { will_copy_redist=true; }},
     {false, "/h",    [&]() { will_help = true; }},
     {false, "/?",    [&]() { will_help = true; }},
     {false, "/nb",   [&]() { not_build = true; }},
     {false, "/ex",   [&]() { executable_name_provided = true; }},
     {false, "/v",    [&]() { will_show_version = true; }},
-    {false, "/Y",    [&]() { force=true; }}
+    {false, "/Y",    [&]() { force=true; }},
+    {false, "/regen", [&]() { force_regen=true; }},
+    {false, "/native", [&]() { native=true; }},
+    {false, "/msbuild", [&]() { native=false; }},
+    {false, "/j",    [&]() { parse_jobs(arg.pop()); }},
+    {false, "-j",    [&]() { parse_jobs(arg.pop()); }},
+    {false, "/nocache", [&]() { build_opts.use_cache = false; }},
+    {false, "/live", [&]() { build_opts.live = true; }},
+    {false, "/nopch", [&]() { build_opts.pch = false; }},
+    {false, "/unity", [&]() { build_opts.unity = true; }},
+    {false, "/local", [&]() { build_opts.distribute = false; }},
+    {false, "/trace", [&]() {
+      // relative to where momobuild was started, not the root dir
+      tracer().path = fs::absolute(arg.pop()).string();
+      tracer().lane();
+    }},
+    {false, "/timeout", [&]() { parse_timeout(arg.pop()); }},
+    {false, "/retries", [&]() { parse_retries(arg.pop()); }},
+    {false, "/shard", [&]() { parse_shard(arg.pop()); }},
+    // like /trace, relative to where momobuild was started
+    {false, "/junit", [&]() { junit_path = fs::absolute(arg.pop()).string(); }},
+    {false, "/json", [&]() { json_path = fs::absolute(arg.pop()).string(); }}
   };
 
   std::vector<Subcmd> subcommands = {
@@ -225,206 +4894,258 @@ int main(int argc, char *argv[]) {
       if (will_run) ERR("`srun` and `run` cannot be called simultaneously\n");
       will_srun=true;
     }},
-    {false, "dir",	[&]() {
-      change_to_root_dir();
-      if (config == "All") config="Debug";
-      win::open_dir(FMT("bin\\{}\\", (config.empty() ? "Debug" : config)));
-    }},
+    {false, "build",	[&]() { will_build = true; }},
+    {false, "test",	[&]() { will_test = true; }},
+    {false, "dir",	[&]() { will_open_dir = true; }},
     {false, "clean",	[&]() { will_clean = true; }},
     {false, "sln",	[&]() {
       open_sln=true;
     }},
     {false, "reset",    [&]() { will_reset = true; }},
-    {false, "etags",    [&]() { will_etags = true; }}
+    {false, "etags",    [&]() { will_etags = true; }},
+    {false, "cache",    [&]() { will_show_cache = true; }},
+    {false, "toolchain", [&]() { will_show_toolchain = true; }},
+    {false, "worker",   [&]() { will_work = true; }},
+    {false, "cache-server", [&]() { will_serve_cache = true; }},
+    {false, "watch",    [&]() {
+      if (will_run || will_srun) ERR("`run` goes after `watch`\n");
+      will_watch = true;
+    }}
   };
 
-  auto run_msbuild = [&](std::string config="Debug") {
-    if (!quiet) print("\n{}: Running MSBuild [{}]...\n", "momobuild", config);
-    if (config=="All") {
-      // TODO: win::run_sync() cannot disable echoing in this version.
-      int ret = win::run_sync(MSBUILD_PATH, FMT("-p:configuration={} {} build\\{}.sln -v:m -m", "Debug", project_name, MSBUILD_OPTIONS));
-      if (ret != 0){
-	exit(ret);
-      }
-      ret = win::run_sync (MSBUILD_PATH, FMT("-p:configuration={} {} build\\{}.sln -v:m -m", "Release", project_name, MSBUILD_OPTIONS));
-      if (ret != 0){
-	exit(ret);
-      }
-    } else {
-      int ret = win::run_sync(MSBUILD_PATH, FMT("-p:configuration={} {} build\\{}.sln -v:m -m", config, MSBUILD_OPTIONS, project_name));
-      if (ret != 0){
-	exit(ret);
-      }
+#if defined USE_WINAPI
+  auto msbuild_args = [&](const std::string& config, size_t jobs) {
+    return std::vector<std::string>{FMT("-p:configuration={}", config), MSBUILD_OPTIONS, FMT("build\\{}.sln", project_name), "-v:m", FMT("-m:{}", jobs)};
+  };
+#else
+  auto msbuild_args = [&](std::string config, size_t jobs) {
+    // gmake2 names its configs in lowercase
+    return std::vector<std::string>{"-C", "build", FMT("config={}", str::tolower(config)), FMT("-j{}", jobs)};
+  };
+#endif
+
+  // both return the exit code of what failed, 0 if nothing did
+  auto run_msbuild = [&](const std::vector<std::string>& configs) {
+    const size_t jobs = build_opts.jobs ? build_opts.jobs : std::max<size_t>(1, std::thread::hardware_concurrency());
+    if (configs.size() == 1){
+      if (!quiet) print("\n{}: Running MSBuild [{}]...\n", "momobuild", configs[0]);
+      TraceSpan span("build", FMT("msbuild [{}]", configs[0]));
+      int ret = proc::run_sync(tool_cache().tool("msbuild", MSBUILD_PROGRAM), msbuild_args(configs[0], jobs));
+      span.set_proc(ret);
+      return ret;
+    }
+
+    // every config gets its share of the job budget; their output is collected
+    // and printed in one piece when the config is done so it doesn't interleave
+    const size_t share = std::max<size_t>(1, jobs / configs.size());
+    std::vector<int> rets(configs.size(), 0);
+    std::vector<std::thread> threads{};
+    const std::string msbuild = tool_cache().tool("msbuild", MSBUILD_PROGRAM);
+    output_mux().begin(configs.size());
+    for (size_t i = 0; i < configs.size(); ++i){
+      threads.emplace_back([&, i](){
+	std::string output{};
+	const std::string label = FMT("msbuild [{}]", configs[i]);
+	TraceSpan span("build", label);
+	rets[i] = output_mux().run(label, msbuild, msbuild_args(configs[i], share), output, build_opts.live);
+	span.set_proc(rets[i]);
+	span.end();
+	if (build_opts.live) output.clear();
+	if (!quiet || rets[i] != 0){
+	  std::string line = FMT("\n{}: MSBuild [{}] {}...\n", "momobuild", configs[i], rets[i] == 0 ? "finished" : "failed");
+	  output_mux().emit(line + output);
+	}
+      });
+    }
+    for (auto& t : threads) t.join();
+    for (auto& ret : rets){
+      if (ret != 0) return ret;
     }
+    return 0;
   };
 
   auto run_premake = [&]() {
+    TraceSpan span("momobuild", "run_premake");
+    const std::string premake = tool_cache().tool("premake5", PREMAKE5_PROGRAM);
+    std::string fingerprint = premake_fingerprint(premake, PREMAKE5_GENERATOR);
+    bool generated = false;
+    if (fs::is_directory("build")){
+      for (auto& e : fs::directory_iterator("build")){
+	if (e.path().extension() == ".sln" || e.path().extension() == ".make"){
+	  generated = true;
+	  break;
+	}
+      }
+    }
+    auto last = metadata().get("premake_fingerprint");
+    if (!force_regen && generated && last && last.unwrap() == fingerprint){
+      if (!quiet) print("\n{}: Project files are up to date, skipping Premake5...\n", "momobuild");
+      return 0;
+    }
+
     if (!quiet) print("\n{}: Running Premake5...\n", "momobuild");
-    int ret = win::run_sync(PREMAKE5_PATH, "vs2022");
-    if (ret != 0) exit(ret);
+    int ret = proc::run_sync(premake, std::vector<std::string>{PREMAKE5_GENERATOR});
+    span.set_proc(ret);
+    if (ret != 0) return ret;
+
+    metadata().set("premake_fingerprint", fingerprint);
+    if (!metadata().flush()) fprint(std::cerr, "WARNING: Could not write {}\n", METADATA_PATH);
+    return 0;
   };
 
   auto run = [&](){
     if (!quiet) {
-      print("\n{}: Running {}.exe[{}]...\n", "momobuild", (!executable_name.empty() ? executable_name : project_name), config);
+      print("\n{}: Running {}{}[{}]...\n", "momobuild", (!executable_name.empty() ? executable_name : project_name), EXE_SUFFIX, config);
       print("--------------------------------------------------\n");
     }
-    win::change_dir(FMT("bin\\{}\\", config).c_str());
-    int ret = win::run_sync(FMT("{}.exe", (!executable_name.empty() ? executable_name : project_name)), executable_args);
+    fs::current_path(fs::path("bin") / config);
+    std::string exe = (fs::current_path() / FMT("{}{}", (!executable_name.empty() ? executable_name : project_name), EXE_SUFFIX)).string();
+    TraceSpan span("run", exe);
+    int ret = proc::run_sync(exe, executable_args);
+    span.set_proc(ret);
+    span.end();
     if (ret != 0){
       exit(ret);
     }
 
-    win::change_dir(root_dir.c_str());
+    fs::current_path(root_dir);
   };
 
   auto srun = [&](){
     if (!quiet) {
-      print("\n{}: Running {}.exe[{}] as a new process...\n", "momobuild", (!executable_name.empty() ? executable_name : project_name), config);
+      print("\n{}: Running {}{}[{}] as a new process...\n", "momobuild", (!executable_name.empty() ? executable_name : project_name), EXE_SUFFIX, config);
       print("--------------------------------------------------\n");
     }
-    win::change_dir(FMT("bin\\{}\\", config).c_str());
-    int ret = win::run_sync(FMT("{}.exe", (!executable_name.empty() ? executable_name : project_name)), executable_args, true);
+    fs::current_path(fs::path("bin") / config);
+    std::string exe = (fs::current_path() / FMT("{}{}", (!executable_name.empty() ? executable_name : project_name), EXE_SUFFIX)).string();
+    TraceSpan span("run", exe);
+    int ret = proc::run_sync(exe, executable_args, true);
+    span.set_proc(ret);
+    span.end();
     if (ret != 0){
       exit(ret);
     }
-    win::change_dir(root_dir.c_str());
+    fs::current_path(root_dir);
   };
   // validators
   auto is_valid_config = [&](const std::string& a){
-    for (auto& c : valid_configs){
-      if (a==c){
-	return true;
-      }
-    }
-    return false;
-  };
-
-  auto is_valid_flag = [&](const std::string& a){
-    for (auto& f : flags){
-      if (f.name == a){
-	return true;
-      }
-    }
-    return false;
-  };
-
-  auto is_valid_subcommand = [&](const std::string& a){
-    for (auto& s : subcommands){
-      if (s.name == a){
-	return true;
-      }
+    // `Debug,Release`
+    size_t start{0};
+    while (start <= a.size()){
+      size_t end = a.find(',', start);
+      if (end == std::string::npos) end = a.size();
+      if (std::find(valid_configs.begin(), valid_configs.end(), a.substr(start, end - start)) == valid_configs.end()) return false;
+      start = end + 1;
     }
-    return false;
+    return true;
   };
 
+  // flags and subcommands by name, flags are the ones starting with `/` (and -j)
+  std::unordered_map<std::string, Subcmd*> commands{};
+  for (auto& f : flags) commands[f.name] = &f;
+  for (auto& s : subcommands) commands[s.name] = &s;
 
   // parse command line arguments
-  // Usage: momobuild.exe [Config] [Flag] [Subcommand]
+  // Usage: momobuild.exe [Config] [Flag] [Subcommand...] [--] [executable args]
   bool config_handled = false;
-  bool flag_handled = false;
-  bool subcommand_handled = false;
+  bool passing_args = false; // everything after `run`, `srun` or `--` goes to the executable
+  std::vector<std::string> steps{}; // the subcommands, in the order they were given
 
- parse_arg:
   while (arg) {
     std::string a = arg.pop();
 
-    // try to parse as executable name or args
-    if (subcommand_handled && (will_run || will_srun)){
+    if (passing_args || will_run || will_srun){
+      // `run -- args` is the same as `run args`
+      if (!passing_args && a == "--"){
+	passing_args = true;
+	continue;
+      }
+      passing_args = true;
       // if the `ex` arg is provided handle that
       if (executable_name.empty() && executable_name_provided){
 	executable_name = a;
-	goto parse_arg;
+	continue;
       }
       // append the arg to the executable args
       executable_args += (executable_args.empty() ? "" : " ");
       executable_args += a;
-      goto parse_arg;
+      continue;
+    }
+
+    if (a == "--"){
+      passing_args = true;
+      continue;
+    }
+
+    // `-j8` is short for `-j 8`
+    if (a.size() > 2 && a.starts_with("-j")){
+      parse_jobs(a.substr(2));
+      continue;
     }
 
+    auto it = commands.find(a);
     // check if the argument starts with `/`
-    if (a[0] == '/'){ // this is a flag
-      // check if the flag is valid
-      if (flag_handled){
-	fprint(std::cerr, "ERROR: Can only provide one flag at a time\n");
+    if (a[0] == '/' || a == "-j"){ // this is a flag
+      if (it == commands.end()){
+	fprint(std::cerr, "ERROR: Invalid flag `{}`\n", a);
 	exit(1);
       }
-      for (auto& f : flags){
-        if (f.handle(a)){
-	  flag_handled = true;
-	  break;
-	}
-      }
-      if (!flag_handled){
-	fprint(std::cerr, "ERROR: Invalid flag `{}`\n", a);
+      if (!it->second->handle(a)){
+	fprint(std::cerr, "ERROR: Flag `{}` provided more than once\n", a);
 	exit(1);
-      } else {
-	goto parse_arg;
       }
-    } else {
-      // check if it's a config
-      if (!config_handled) {
-        if (is_valid_config(a)){
-	  config = a;
-	  config_handled = true;
-	  goto parse_arg;
-	}
+      continue;
+    }
 
-	/// no config, subcomand
+    if (!config_handled && is_valid_config(a)){
+      config = a;
+      config_handled = true;
+      continue;
+    }
 
-	// if the subcommand is already handled
-	if (subcommand_handled){
-	  if (is_valid_subcommand(a)){
-	    fprint(std::cerr, "ERROR: Can only provide one subcommand at a time\n");
-	    exit(1);
-	  } else{
-	    fprint(std::cerr, "ERROR: Invalid subcommand `{}`\n", a);
-	    exit(1);
-	  }
-	}
-	for (auto& s : subcommands){
-	  if (s.handle(a)){
-	    subcommand_handled=true;
-	    if (s.name == "init"){
-	      project_name = arg.pop();
-	    }
-	    break;
-	  }
-	}
-	if (!subcommand_handled){
-	  fprint(std::cerr, "ERROR: Invalid config/subcommand `{}`\n", a);
-	  exit(1);
-	} else {
-	  goto parse_arg;
-	}
-      } else {
-	/// config provided, so try to parse as subcommand
-
-        // if the subcommand is already handled
-	if (subcommand_handled){
-	  if (is_valid_subcommand(a)){
-	    fprint(std::cerr, "ERROR: Can only provide one subcommand at a time\n");
-	    exit(1);
-	  } else{
-	    fprint(std::cerr, "ERROR: Invalid subcommand `{}`\n", a);
-	    exit(1);
-	  }
-	}
-	for (auto& s : subcommands){
-	  if (s.handle(a)){
-	    subcommand_handled=true;
-	    break;
-	  }
-	}
-	if (!subcommand_handled){
-	  fprint(std::cerr, "ERROR: Invalid subcommand `{}`\n", a);
-	  exit(1);
-	} else {
-	  goto parse_arg;
-	}
-      }
+    if (it == commands.end()){
+      if (config_handled) fprint(std::cerr, "ERROR: Invalid subcommand `{}`\n", a);
+      else fprint(std::cerr, "ERROR: Invalid config/subcommand `{}`\n", a);
+      exit(1);
+    }
+    if (!it->second->handle(a)){
+      fprint(std::cerr, "ERROR: Subcommand `{}` provided more than once\n", a);
+      exit(1);
+    }
+    steps.push_back(a);
+    if (a == "init"){
+      project_name = arg.pop();
     }
+    if (a == "worker" && arg){
+      worker_listen = worker_address(arg.pop());
+    }
+    if (a == "cache-server" && arg){
+      cache_server_listen = arg.pop();
+      if (!cache_server_listen.starts_with("unix:") && cache_server_listen.find(':') == std::string::npos) cache_server_listen += ":" REMOTE_CACHE_PORT;
+    }
+  }
+
+  // these keep going until they're killed, anything after them would never run
+  for (const char* endless : {"worker", "cache-server"}){
+    if (steps.size() > 1 && std::find(steps.begin(), steps.end(), endless) != steps.end()){
+      ERR("`{}` runs until it's killed, it can't be combined with other subcommands\n", endless);
+    }
+  }
+  if (will_watch && (will_build || will_open_dir || open_sln || will_test)){
+    ERR("`watch` builds by itself until it's killed, it can't be combined with `build`, `dir`, `sln` or `test`\n");
+  }
+
+  if (config.empty()) {
+    config="Debug";
+    if ((will_run || will_srun || will_test) && !will_watch)
+      not_build=true;
   }
+  // a config on its own (or with run or test) builds, next to anything else it takes `build`
+  const bool other_steps = will_copy_redist || will_show_version ||
+    std::any_of(steps.begin(), steps.end(), [](const std::string& s){ return s != "run" && s != "srun" && s != "test" && s != "build" && s != "watch"; });
+  const bool build = !will_watch && (will_build || (!not_build && !other_steps));
+  const bool needs_root = build || will_watch || will_run || will_srun || will_test || will_open_dir || will_show_toolchain ||
+    will_etags || will_reset || will_clean || will_copy_redist || open_sln;
 
   // subcommands/flags that doesn't need to be in root_dir
 
@@ -434,32 +5155,24 @@ int main(int argc, char *argv[]) {
 
   if (will_show_version){
     print("Momobuild Version {}\n", VERSION);
-    exit(0);
   }
 
   if (will_init){
     std::string f{};
     if (!project_name.empty()){ // read the premake5 template if the project name is given
-      std::ifstream ifs;
-      ifs.open(PREMAKE5_TEMPLATE_PATH);
-      if (!ifs.is_open()){
+      const file::MappedFile snippet(PREMAKE5_TEMPLATE_PATH);
+      if (!snippet.is_open()){
 	ERR("Could not open {} for reading...\n", PREMAKE5_TEMPLATE_PATH);
       }
 
-      ifs.seekg(0, std::ios::end);
-      f.resize(ifs.tellg());
-      ifs.seekg(0, std::ios::beg);
+      // the yasnippet header ends with `# --`
+      std::string_view body = snippet.view();
+      sv::lremove_until(body, "# --");
+      sv::lremove(body, 4);
 
-      ifs.read((char*)f.c_str(), f.size());
+      sv::trim(body);
 
-      ifs.close();
-
-      str::lremove_until(f, "# --");
-      str::lremove(f, 4);
-
-      str::trim(f);
-
-      str::replace(f, "$1", project_name);
+      f = str::replace(body, "$1", project_name);
     }
 
     if (!confirmation("This will create a project structure at the current dir, proceed?")) exit(0);
@@ -488,8 +5201,8 @@ int main(int argc, char *argv[]) {
 
     create_dir("src");
     create_dir("bin");
-    create_dir("bin\\Release"); // TODO: Maybe have all Configs in an array and iterator over to create the folders?
-    create_dir("bin\\Debug");
+    create_dir("bin/Release"); // TODO: Maybe have all Configs in an array and iterator over to create the folders?
+    create_dir("bin/Debug");
     create_dir("build");
     create_dir("lib");
     create_dir("include");
@@ -498,42 +5211,74 @@ int main(int argc, char *argv[]) {
     create_file("premake5.lua", f);
     create_file(ROOT_IDENTIFIER, ROOT_IDENTIFIER_TEMPLATE);
     create_file(".gitignore", GITIGNORE_TEMPLATE);
-    create_file("src\\main.cpp");
+    create_file("src/main.cpp");
+  }
 
-    exit(0);
+  if (will_show_cache){
+    ObjectCache cache{};
+    if (!cache.enabled()) ERR("The object cache is disabled, set MOMOBUILD_CACHE_DIR to enable it\n");
+    auto usage = cache.evict();
+    auto [hits, misses] = cache.update_stats();
+    print("Object cache: {}\n", cache.dir.string());
+    print("    entries: {}\n", usage.entries);
+    print("    size:    {:.1f} MiB / {:.1f} MiB\n", double(usage.size) / (1 << 20), double(cache.max_size) / (1 << 20));
+    print("    hits:    {}\n", hits);
+    print("    misses:  {}\n", misses);
+    if (hits + misses) print("    hit rate: {:.1f}%\n", 100.0 * double(hits) / double(hits + misses));
+  }
+
+  if (will_work){
+    const size_t slots = build_opts.jobs ? build_opts.jobs : std::max<size_t>(1, std::thread::hardware_concurrency());
+    exit(run_worker(worker_listen, slots, quiet));
+  }
+
+  if (will_serve_cache){
+    fs::path dir = get_env("MOMOBUILD_CACHE_SERVER_DIR");
+    if (dir.empty()) dir = ObjectCache::default_dir() / "shared";
+    if (dir == "shared") ERR("Could not tell where to keep the cache, set MOMOBUILD_CACHE_SERVER_DIR\n");
+    exit(run_cache_server(cache_server_listen, fs::absolute(dir), quiet));
   }
 
+  if (!needs_root) exit(0);
   change_to_root_dir();
 
-  if (will_etags){
-    std::string etags_cmd{};
-    collect_source_files(etags_cmd, ".", fs::current_path().string());
-    VAR(etags_cmd);
-    ASSERT(fs::current_path().string() == root_dir);
-    if (!quiet) print("\n{}: Running etags...\n", "momobuild");
-    int ret = win::run_sync("etags", etags_cmd);
-    if (ret != 0){
-      exit(ret);
+  if (will_show_toolchain){
+    ToolCache& cache = tool_cache();
+    const Toolchain& tc = build_state().tc;
+    print("premake5: {}\n", cache.tool("premake5", PREMAKE5_PROGRAM));
+    print("{}: {}\n", str::tolower(MSBUILD_PROGRAM), cache.tool("msbuild", MSBUILD_PROGRAM));
+    print("ar: {}\n", tc.ar);
+    if (tc.msvc) print("link: {}\n", tc.ld);
+    std::vector<std::string> configurations = fs::exists("premake5.lua") ? workspace().configurations : std::vector<std::string>{};
+    if (configurations.empty()) configurations = {"Debug", "Release"};
+    for (auto& c : configurations){
+      const std::string linker = pick_linker(tc, c);
+      print("linker [{}]: {}\n", c, linker.empty() ? "default" : linker);
     }
-    exit(0);
+    auto show = [&](const std::string& name, const std::string& path, bool c){
+      const CompilerInfo& info = cache.probe(path, tc.msvc, c);
+      print("{}: {}\n", name, path);
+      print("    version: {}\n", info.version);
+      print("    include dirs:\n");
+      for (auto& d : info.include_dirs) print("        {}\n", d);
+      print("    predefined macros: {}\n", info.macros.size());
+    };
+    show("cc", tc.cc, true);
+    show("cxx", tc.cxx, false);
   }
 
   if (will_reset){
     if (!confirmation("This will remove all folders, continue?")) exit(0);
-    for (auto& dir : win::get_dirs_in_dir(".")){
-      if (dir[0] != '.'){
-        fs::remove_all(dir);
-	if (!quiet) print("INFO: Removed {}...\n", dir);
-      }
-    }
-
-    for (auto& f : win::get_files_in_dir(".")){
-      if (f == "premake5.lua" || f == ROOT_IDENTIFIER || f == ".gitignore"){
-	fs::remove(f);
-	if (!quiet) print("INFO: Removed {}...\n", f);
+    for (auto& e : fs::directory_iterator(".")){
+      std::string name = e.path().filename().string();
+      if (e.is_directory() && name[0] != '.'){
+        fs::remove_all(e.path());
+	if (!quiet) print("INFO: Removed {}...\n", name);
+      } else if (name == "premake5.lua" || name == ROOT_IDENTIFIER || name == ".gitignore"){
+	fs::remove(e.path());
+	if (!quiet) print("INFO: Removed {}...\n", name);
       }
     }
-    exit(0);
   }
 
   if (will_clean){
@@ -547,43 +5292,171 @@ int main(int argc, char *argv[]) {
     if (cleaned==0 && !quiet){
       print("INFO: Nothing to remove...\n");
     }
-
-    exit(0);
   }
 
-  if (config.empty()) {
-    config="Debug";
-    if (will_run || will_srun)
-      not_build=true;
-  }
+  const std::vector<std::string> configs = config_names();
 
   if (will_copy_redist){
+#if !defined USE_WINAPI
+    ERR("/Rdst is only supported on windows\n");
+#endif
     get_project_name();
     if (!fs::exists("redist")) {
       fs::create_directory("redist");
       if (!quiet) print("INFO: Created {}\\...\n", "redist");
     }
-    fs::copy(FMT("{}{}{}", VCREDIST_PATH, VCREDIST_EXE, "x64.exe"), "redist\\", fs::copy_options::update_existing | fs::copy_options::recursive);
+    const fs::path vcredist = find_vcredist(tool_cache().topdir["vcredist_path"], tool_cache().tool("msbuild", MSBUILD_PROGRAM));
+    if (vcredist.empty()) ERR("Could not find {}x64.exe, set vcredist_path in {}\n", VCREDIST_EXE, ROOT_IDENTIFIER);
+    fs::copy(vcredist / FMT("{}{}", VCREDIST_EXE, "x64.exe"), "redist\\", fs::copy_options::update_existing | fs::copy_options::recursive);
     if (!quiet) print("INFO: Copied {}{}...\n", VCREDIST_EXE, "x64.exe");
-    fs::copy(FMT("{}{}{}", VCREDIST_PATH, VCREDIST_EXE, "x86.exe"), "redist\\", fs::copy_options::update_existing | fs::copy_options::recursive);
+    fs::copy(vcredist / FMT("{}{}", VCREDIST_EXE, "x86.exe"), "redist\\", fs::copy_options::update_existing | fs::copy_options::recursive);
     if (!quiet) print("INFO: Copied {}{}...\n", VCREDIST_EXE, "x86.exe");
-
-    exit(0);
   }
 
   if (open_sln) {
+#if !defined USE_WINAPI
+    ERR("sln is only supported on windows\n");
+#endif
     get_project_name();
     if (!quiet) print("{}: Opening {}.sln...\n", "momobuild", project_name);
-    win::open_file(FMT("build\\{}.sln", project_name));
-    exit(0);
+    os::open_file((fs::path("build") / FMT("{}.sln", project_name)).string());
+  }
+
+  // etags only reads the sources, so it runs alongside the build
+  std::thread etags{};
+  std::atomic<int> etags_ret{0};
+  auto tags = [&](){
+    ScanOptions scan_opts{};
+    scan_opts.suffixes = source_suffixes;
+    scan_opts.jobs = build_opts.jobs;
+    etags_ret = update_tags(scan_tree(".", scan_opts), build_opts.jobs, quiet);
+  };
+  // waits for etags and stops if it failed
+  auto finish_etags = [&](){
+    if (etags.joinable()) etags.join();
+    if (etags_ret != 0) exit(etags_ret);
+  };
+  // stops with `ret` once etags is done too
+  auto stop = [&](int ret){
+    if (etags.joinable()) etags.join();
+    exit(ret);
+  };
+  if (will_etags){
+    if (build || will_watch){
+      etags = std::thread(tags);
+      // an ERR or ASSERT from here on joins etags before exit() tears down the singletons it uses
+      panic_hook = [&](){
+	if (etags.joinable() && etags.get_id() != std::this_thread::get_id()) etags.join();
+      };
+    } else tags();
   }
 
+  if (will_watch){
+    if (!native) ERR("`watch` needs the native build (/native)\n");
+    build_opts.quiet = quiet;
+    Workspace wks = workspace();
+    BuildState& state = build_state();
+    Watcher watcher{};
+    Option<proc::Proc> running{};
+    // the previous instance goes away before the new one starts
+    auto restart = [&](){
+      if (running) proc::kill_proc(running.unwrap());
+      running = Option<proc::Proc>{};
+      project_name = native_project_name(wks);
+      const std::string name = !executable_name.empty() ? executable_name : project_name;
+      if (!quiet){
+	print("\n{}: Running {}{}[{}]...\n", "momobuild", name, EXE_SUFFIX, configs[0]);
+	print("--------------------------------------------------\n");
+      }
+      fs::current_path(fs::path("bin") / configs[0]);
+      std::string exe = (fs::current_path() / FMT("{}{}", name, EXE_SUFFIX)).string();
+      running = proc::run_async(exe, executable_args);
+      fs::current_path(root_dir);
+    };
 
-  if (!not_build){
-    run_premake();
-    ASSERT(fs::exists("build"));
-    get_project_name();
-    run_msbuild(config);
+    int ret = build_native(wks, configs, build_opts, state);
+    finish_etags();
+    if (ret == 0 && will_run) restart();
+    for (;;){
+      if (!quiet) print("\n{}: Watching for changes...\n", "momobuild");
+      WatchChanges changes = watcher.wait();
+      auto start = std::chrono::steady_clock::now();
+      if (changes.premake_changed){
+	wks = parse_workspace();
+	state.forget_projects();
+      } else if (changes.tree_changed || changes.overflowed){
+	state.forget_projects();
+      }
+      if (changes.overflowed) state.deps.clear();
+      else state.forget(changes.paths);
+      if (!quiet) print("\n{}: {} file(s) changed, rebuilding...\n", "momobuild", changes.paths.size());
+      TraceSpan span("build", "rebuild");
+      ret = build_native(wks, configs, build_opts, state);
+      span.end();
+      // watch only ends when it's killed, so the trace is written after every build
+      if (tracer().enabled()) tracer().save();
+      if (!quiet){
+	auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	print("{}: Build {} in {} ms\n", "momobuild", ret == 0 ? "finished" : "failed", ms);
+      }
+      if (ret == 0 && will_run) restart();
+    }
+  }
+
+  if (build){
+    if (native){
+      build_opts.quiet = quiet;
+      TraceSpan span("build", "build_native");
+      int ret = build_native(workspace(), configs, build_opts, build_state());
+      span.end();
+      if (ret != 0) stop(ret);
+    } else {
+      int ret = run_premake();
+      if (ret != 0) stop(ret);
+      ASSERT(fs::exists("build"));
+      get_project_name();
+      ret = run_msbuild(configs);
+      if (ret != 0) stop(ret);
+    }
+  }
+  finish_etags();
+
+  if (will_test){
+    std::vector<TestResult> tests{};
+    for (auto& c : configs){
+      auto found = test_targets(workspace(), c);
+      tests.insert(tests.end(), found.begin(), found.end());
+    }
+    shard_tests(tests, test_shard, test_shards);
+    if (tests.empty()) ERR("No tests to run; name them `*test*` or list them in {}'s `tests`\n", ROOT_IDENTIFIER);
+    if (!quiet) print("\n{}: Running {} test(s)...\n", "momobuild", tests.size());
+    test_opts.jobs = build_opts.jobs;
+    test_opts.quiet = quiet;
+    test_opts.live = build_opts.live;
+    TraceSpan span("test", "run_tests");
+    run_tests(tests, proc::split_cmd(executable_args), test_opts);
+    span.end();
+
+    size_t failed{0}, flaky{0};
+    for (auto& t : tests){
+      if (!t.passed()) failed++;
+      if (t.flaky()) flaky++;
+    }
+    auto write_report = [&](const std::string& path, const std::string& report){
+      std::ofstream ofs(path, std::ios::binary);
+      if (!ofs.is_open() || !(ofs << report)) fprint(std::cerr, "WARNING: Could not write {}\n", path);
+    };
+    if (!junit_path.empty()) write_report(junit_path, junit_report(tests));
+    if (!json_path.empty()) write_report(json_path, json_report(tests));
+    if (!quiet || failed) print("\n{}: {} passed, {} failed, {} flaky\n", "momobuild", tests.size() - failed, failed, flaky);
+    if (failed) exit(1);
+  }
+
+  // several configs were built, run the first one
+  config = configs[0];
+
+  if (will_open_dir){
+    os::open_dir((fs::path("bin") / config).string());
   }
 
   if (will_run){